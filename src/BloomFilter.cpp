@@ -0,0 +1,57 @@
+// Project includes
+#include "BloomFilter.h"
+
+// a second, independent looking hash picks the bits within the block
+static inline uint32_t remix(uint32_t h){
+    h ^= h >> 16;
+    h *= 0x85EBCA6B;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35;
+    h ^= h >> 16;
+    return h;
+}
+
+BloomFilter::BloomFilter(size_t keys){
+    size_t nbits = keys * BITS_PER_KEY;
+    blocks = (nbits + BLOCK_WORDS * 32 - 1) / (BLOCK_WORDS * 32);
+    if (blocks == 0) blocks = 1;
+    words.assign((size_t) blocks * BLOCK_WORDS, 0);
+    bits = &words[0];
+}
+
+BloomFilter::BloomFilter(const uint32_t* w, uint32_t b)
+    : bits(w), blocks(b) {}
+
+BloomFilter::BloomFilter(const BloomFilter& src){} // private copy constructor does nothing
+
+// the high bits of hash pick the block, without a division
+const uint32_t* BloomFilter::block_of(uint32_t hash) const {
+    uint32_t block = (uint32_t) (((uint64_t) hash * blocks) >> 32);
+    return bits + (size_t) block * BLOCK_WORDS;
+}
+
+// only for filters that own their bits
+void BloomFilter::add(uint32_t hash){
+    uint32_t* block = const_cast<uint32_t*>(block_of(hash));
+    uint32_t h = remix(hash);
+    uint32_t step = (h >> 9) | 1;
+    for (unsigned int i = 0; i < PROBES; i++, h += step)
+        block[(h >> 5) & (BLOCK_WORDS - 1)] |= 1u << (h & 31);
+}
+
+bool BloomFilter::contains(uint32_t hash) const {
+    const uint32_t* block = block_of(hash);
+    uint32_t h = remix(hash);
+    uint32_t step = (h >> 9) | 1;
+    for (unsigned int i = 0; i < PROBES; i++, h += step)
+        if ((block[(h >> 5) & (BLOCK_WORDS - 1)] & (1u << (h & 31))) == 0)
+            return false;
+    return true;
+}
+
+const uint32_t* BloomFilter::data() const { return bits; }
+
+// in bytes
+size_t BloomFilter::size() const { return (size_t) blocks * BLOCK_WORDS * sizeof(uint32_t); }
+
+uint32_t BloomFilter::block_count() const { return blocks; }
@@ -0,0 +1,49 @@
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+// stdl includes
+#include <vector>
+
+// libc includes
+#include <stdint.h>
+#include <stddef.h>
+
+// A blocked Bloom filter over 32-bit hashes. Each hash sets or tests PROBES
+// bits within a single 64-byte block, so a query costs one cache miss. With
+// about BITS_PER_KEY bits per key, roughly 1% of the hashes never added are
+// reported as present, and a hash that was added never reported absent.
+//
+// The filter is built once and only read afterwards, from any number of
+// threads. Its bits can be saved and used later in place, through the second
+// constructor, which doesn't copy them.
+class BloomFilter {
+public:
+    BloomFilter(size_t keys);
+    BloomFilter(const uint32_t* words, uint32_t blocks);
+
+    void add(uint32_t hash);
+    bool contains(uint32_t hash) const;
+
+    // the bits, size() bytes of them
+    const uint32_t* data() const;
+    size_t size() const;
+    uint32_t block_count() const;
+
+    // constants
+    static const unsigned int BITS_PER_KEY = 10;
+    static const unsigned int PROBES = 7;
+
+private:
+    BloomFilter(const BloomFilter& src);
+
+    static const unsigned int BLOCK_WORDS = 16;
+
+    const uint32_t* block_of(uint32_t hash) const;
+
+    // empty when the bits are somebody else's
+    std::vector<uint32_t> words;
+    const uint32_t* bits;
+    uint32_t blocks;
+};
+
+#endif // BLOOM_FILTER_H
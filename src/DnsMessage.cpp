@@ -8,118 +8,13 @@
 
 // Project includes
 #include "trace.h"
+#include "helper.h"
+#include "UdpSocket.h"
 #include "DnsMessage.h"
 
 // usings
 using namespace std;
 
-//  use this example for reference
-//
-//              8 m y d o m a i n 3 c o m 0
-//              0 1 2 3 4 5 6 7 8 9 a b c d
-//              m y d o m a i n . c o m 0
-//
-//
-size_t DnsMessage::parse_qname(const char* buff, size_t buflen, char* resulting_thing) {
-    // total_len keeps the number of character processed
-    size_t total_len = 0;
-    // ptr should always point to beginning of a label. A special label whose first
-    // byte is 0 marks the end of this domain name
-    size_t pos = 0;
-    while (true) {
-        // check if we reached the end label
-        if (buff[pos]==0) {
-            resulting_thing[total_len - 1] = '\0'; // null terminate the thing!
-            return total_len + 1;
-        }
-        // check if the topmost two bits are 00 as required
-        if ((buff[pos] & 0xC0) != 0)
-            throw DnsException(getID(), DnsErrorResponse::FORMAT_ERROR, TRACELINE("Unknown domain label type"));
-        size_t label_len = (buff[pos] & 0x3F);
-        if (label_len > (buflen - total_len - 2))
-            throw DnsException(getID(), DnsErrorResponse::FORMAT_ERROR, TRACELINE("One label mentions more characters than exist"));
-
-        memcpy(&resulting_thing[total_len], &buff[pos + 1], label_len);
-
-        total_len += (1 + label_len);
-        if (total_len >= 255)
-            throw DnsException(getID(), DnsErrorResponse::FORMAT_ERROR, TRACELINE("Domain name too long"));
-
-        resulting_thing[total_len - 1]='.';
-
-        pos += label_len + 1;
-    }
-}
-// len is the total size of data to consider
-DnsMessage::DnsMessage(char *data, const size_t len) throw (DnsException){
-    uint16_t
-        question_count, // question count
-        answer_count, // answer count
-        authorities_count, // authorities count
-        ar_count; // additional record count
-
-    ID = ntohs(*(uint16_t*)&data[0]);
-
-    if (len < 12) throw DnsException(getID(), DnsErrorResponse::FORMAT_ERROR, TRACELINE("Buffer to small to hold DNS header"));
-
-    QR = (data[2] & 0x80) >> 7;
-
-    if (QR != QUERY) throw DnsException(getID(), DnsErrorResponse::FORMAT_ERROR, TRACELINE("Uhhh. Client talking back to the server"));
-
-    OPCODE = (data[2] & 120) >> 3;
-
-    if (OPCODE != QUERY_A) throw DnsException(getID(), DnsErrorResponse::NOT_IMPLEMENTED, TRACELINE("Only simple QUERY operation supported"));
-
-    AA = (data[2] & 0x04) >> 2;
-
-    if (AA != 0) throw DnsException(getID(), DnsErrorResponse::FORMAT_ERROR, TRACELINE("Client thinks he's some kind of authority"));
-
-    TC = (data[2] & 0x02) >> 1;
-
-    if (TC != false) throw DnsException(getID(), DnsErrorResponse::FORMAT_ERROR, TRACELINE("Client sent a truncated message, why?"));
-
-    RD = (data[2] & 0x01);
-
-    RA = (data[3] & 0x80) >> 7;
-
-    if (RA != false) throw DnsException(getID(), DnsErrorResponse::FORMAT_ERROR, TRACELINE("Nice to know the client has recursion"));
-
-    Z = (data[3] & 0x70) >> 3;
-
-    // RCODE in queries is ignored
-    RCODE = data[3] & 0x0F;
-
-    question_count    = ntohs(*(uint16_t*)&data[4]);
-    answer_count      = ntohs(*(uint16_t*)&data[6]);
-    authorities_count = ntohs(*(uint16_t*)&data[8]);
-    ar_count          = ntohs(*(uint16_t*)&data[10]);
-
-  /* read question section */
-
-    size_t pos = 12;
-    for (int i = 0; i < question_count; i++) {
-        if (pos >= len)
-            throw DnsException(getID(), DnsErrorResponse::FORMAT_ERROR, TRACELINE("So many questions, so little buffer space!"));
-
-        char *domainbuff = new char[len - pos - 4];
-        int qname_len = parse_qname(&data[12], len - pos - 4, domainbuff);
-
-        pos += qname_len;
-
-        DnsQuestion question(
-            domainbuff,
-            ntohs(*(uint16_t*)&data[pos]),
-            ntohs(*(uint16_t*)&data[pos+2]));
-        questions.push_back(question);
-
-        pos += 4;
-
-        delete []domainbuff;
-    }
-
-  /* all other sections ignored */
-}
-
 DnsMessage::DnsMessage(){
     ID = 0;
     QR = AA = TC = RD = RA = false;
@@ -156,31 +51,33 @@ size_t DnsMessage::serialize(char* buff, const size_t bufsize) throw (SerializeE
     memcpy(&buff[10], &network_short, 2);
 
     size_t pos = 12;
-    
+    NameTable names;
+
     for (list<DnsQuestion>::iterator i = questions.begin(); i != questions.end() ; i++)
-        pos += i->serialize(&buff[pos], bufsize - pos);
+        pos += i->serialize(names, buff, pos, bufsize);
 
     for (list<ResourceRecord>::iterator i = answers.begin(); i != answers.end() ; i++)
-        pos += i->serialize(&buff[pos], bufsize - pos);
+        pos += i->serialize(names, buff, pos, bufsize);
 
     for (list<ResourceRecord>::iterator i = authorities.begin(); i != authorities.end() ; i++)
-        pos += i->serialize(&buff[pos], bufsize - pos);
+        pos += i->serialize(names, buff, pos, bufsize);
 
     for (list<ResourceRecord>::iterator i = additional.begin(); i != additional.end() ; i++)
-        pos += i->serialize(&buff[pos], bufsize - pos);
+        pos += i->serialize(names, buff, pos, bufsize);
 
     return pos;
 }
 
-size_t DnsMessage::DnsQuestion::serialize(char* buff, const size_t bufsize) throw (SerializeException){
+size_t DnsMessage::DnsQuestion::serialize(NameTable& names, char* message, size_t start, const size_t bufsize) throw (SerializeException){
     uint16_t network_short;
+    char* buff = &message[start];
 
-    if (bufsize < 5)
+    if (bufsize < start + 5)
         throw SerializeException("Not enough space for question");
 
     try {
 
-        int pos = serialize_qname(QNAME, &buff[0], bufsize - 4);
+        int pos = names.write(QNAME, message, start, bufsize - 4);
 
         network_short=htons(QTYPE);
         memcpy(&buff[pos], &network_short, 2);
@@ -195,42 +92,158 @@ size_t DnsMessage::DnsQuestion::serialize(char* buff, const size_t bufsize) thro
     }
 }
 
+// empty labels, as in a trailing dot, are skipped
 size_t DnsMessage::serialize_qname(const std::string& qname, char* buff, size_t buflen) throw (DnsMessage::SerializeException){
-    stringstream ss(qname);
-    char *temp = new char[buflen];
     size_t pos = 0;
+    for (size_t start = 0; start < qname.size(); ) {
+        size_t dot = qname.find('.', start);
+        if (dot == string::npos)
+            dot = qname.size();
+        size_t label_len = dot - start;
+        if (label_len > 63)
+            throw SerializeException("qname label longer than 63 characters");
+        if (pos + 1 + label_len >= buflen)
+            throw SerializeException("qname label won't fit into buffer");
+        if (label_len > 0) {
+            buff[pos] = label_len;
+            memcpy(&buff[pos + 1], &qname[start], label_len);
+            pos += label_len + 1;
+        }
+        start = dot + 1;
+    }
+    if (pos >= buflen)
+        throw SerializeException("qname won't fit into buffer");
+    buff[pos] = 0;
+    return pos + 1;
+}
+
+bool DnsMessage::valid_name(const std::string& qname){
+    if (qname.size() > DnsQuery::MAX_NAME)
+        return false;
+    for (size_t start = 0; start < qname.size(); ) {
+        size_t dot = qname.find('.', start);
+        if (dot == string::npos)
+            dot = qname.size();
+        if (dot - start > 63)
+            return false;
+        start = dot + 1;
+    }
+    return true;
+}
+
+// NameTable nested class
+
+DnsMessage::NameTable::NameTable() : count(0) {}
 
-    while (true){
-        if (!ss.getline(temp, buflen, '.')){
-            buff[pos] = 0;
-            delete []temp;
-            return pos + 1;
+// labels past 0x3FFF can't be pointed to
+void DnsMessage::NameTable::add(const char* message, size_t offset){
+    while (message[offset] != 0 && (message[offset] & 0xC0) == 0 && offset <= 0x3FFF && count < MAX_LABELS) {
+        labels[count++] = offset;
+        offset += 1 + (unsigned char) message[offset];
+    }
+}
+
+// names compare regardless of case. Pointers in the message were written
+// by us or checked when parsed, still no more than a few are followed
+bool DnsMessage::NameTable::equal(const char* message, size_t offset, const std::string& name, size_t start){
+    for (unsigned int hops = 0; hops < 16; ) {
+        unsigned char len = message[offset];
+        if ((len & 0xC0) == 0xC0) {
+            offset = ((len & 0x3F) << 8) | (unsigned char) message[offset + 1];
+            hops++;
+            continue;
         }
-        ssize_t label_len = strlen(temp);
+        if (len == 0)
+            return start >= name.size();
+        if (start >= name.size())
+            return false;
+        size_t dot = name.find('.', start);
+        if (dot == string::npos)
+            dot = name.size();
+        if (len != dot - start || !nocase_equal_helper(&message[offset + 1], &name[start], len))
+            return false;
+        offset += 1 + len;
+        start = dot + 1;
+    }
+    return false;
+}
 
-        if (pos + 1 + label_len > buflen)
-        {
-            delete []temp;
+size_t DnsMessage::NameTable::write(const std::string& name, char* message, size_t pos, size_t buflen) throw (SerializeException){
+    size_t written = 0;
+    for (size_t start = 0; start < name.size(); ) {
+        for (unsigned int i = 0; i < count; i++) {
+            if (equal(message, labels[i], name, start)) {
+                if (pos + written + 2 > buflen)
+                    throw SerializeException("qname pointer won't fit into buffer");
+                message[pos + written] = 0xC0 | (labels[i] >> 8);
+                message[pos + written + 1] = labels[i] & 0xFF;
+                add(message, pos);
+                return written + 2;
+            }
+        }
+        size_t dot = name.find('.', start);
+        if (dot == string::npos)
+            dot = name.size();
+        size_t label_len = dot - start;
+        if (label_len > 63)
+            throw SerializeException("qname label longer than 63 characters");
+        if (pos + written + 1 + label_len >= buflen)
             throw SerializeException("qname label won't fit into buffer");
+        if (label_len > 0) {
+            message[pos + written] = label_len;
+            memcpy(&message[pos + written + 1], &name[start], label_len);
+            written += 1 + label_len;
         }
-        
-
-        buff[pos] = label_len & 0x3F;
-        memcpy(&buff[pos+1],&temp[0],label_len);
-        pos += label_len + 1;
+        start = dot + 1;
     }
+    if (pos + written >= buflen)
+        throw SerializeException("qname won't fit into buffer");
+    message[pos + written] = 0;
+    add(message, pos);
+    return written + 1;
 }
 
+//  4.1.168.192.in-addr.arpa asks for 192.168.1.4
+//
+bool DnsMessage::parse_reverse_name(const std::string& qname, struct in_addr& address){
+    static const char SUFFIX[] = ".in-addr.arpa";
+    const size_t suffixlen = sizeof(SUFFIX) - 1;
+    if (qname.size() <= suffixlen ||
+        strncasecmp(qname.c_str() + qname.size() - suffixlen, SUFFIX, suffixlen) != 0)
+        return false;
+
+    // four decimal labels, least significant first
+    uint32_t ip = 0;
+    size_t pos = 0, end = qname.size() - suffixlen;
+    for (int octet = 0; octet < 4; octet++) {
+        unsigned int value = 0;
+        size_t digits = 0;
+        while (pos < end && qname[pos] >= '0' && qname[pos] <= '9' && digits < 3) {
+            value = value * 10 + (qname[pos++] - '0');
+            digits++;
+        }
+        if (digits == 0 || value > 255)
+            return false;
+        ip |= value << (8 * octet);
+        if (octet < 3 && (pos >= end || qname[pos++] != '.'))
+            return false;
+    }
+    if (pos != end)
+        return false;
+    address.s_addr = htonl(ip);
+    return true;
+}
 
-size_t DnsMessage::ResourceRecord::serialize(char* buff, const size_t bufsize) throw (SerializeException){
+size_t DnsMessage::ResourceRecord::serialize(NameTable& names, char* message, size_t start, const size_t bufsize) throw (SerializeException){
     uint16_t network_short;
     uint32_t network_long;
+    char* buff = &message[start];
 
-    if (bufsize < ((size_t)11 - RDLENGTH))
+    if (bufsize < start + 11 + RDLENGTH)
         throw SerializeException("Not enough space for Rrecord");
 
     try {
-        int pos = serialize_qname(NAME, &buff[0], bufsize - 10 - RDLENGTH);
+        int pos = names.write(NAME, message, start, bufsize - 10 - RDLENGTH);
 
         network_short=htons(TYPE);
         memcpy(&buff[pos], &network_short, 2);
@@ -239,7 +252,7 @@ size_t DnsMessage::ResourceRecord::serialize(char* buff, const size_t bufsize) t
         memcpy(&buff[pos + 2], &network_short, 2);
 
         network_long=htonl(TTL);
-        memcpy(&buff[pos + 4], &network_long, 2);
+        memcpy(&buff[pos + 4], &network_long, 4);
 
         network_short=htons(RDLENGTH);
         memcpy(&buff[pos + 8], &network_short, 2);
@@ -271,8 +284,16 @@ std::ostream& operator<<(std::ostream& os, const DnsMessage& m){
     for (list<DnsMessage::DnsQuestion>::iterator i = tempquestions.begin(); i != tempquestions.end() ; i++)
         ss << "(q= \'" << i->QNAME << "\')";
 
-    for (list<DnsMessage::ResourceRecord>::iterator i = tempanswers.begin(); i != tempanswers.end() ; i++)
-        ss << "(r= \'" << i->NAME << "\' : \'" << inet_ntoa(*((in_addr *)i->RDATA)) << "\')";
+    for (list<DnsMessage::ResourceRecord>::iterator i = tempanswers.begin(); i != tempanswers.end() ; i++) {
+        ss << "(r= \'" << i->NAME << "\' : \'";
+        if (i->TYPE == DnsMessage::TYPE_PTR) {
+            // labels of the name, without their lengths
+            for (uint16_t pos = 0; pos < i->RDLENGTH && i->RDATA[pos] != 0; pos += 1 + i->RDATA[pos])
+                ss << (pos ? "." : "") << string(&i->RDATA[pos + 1], i->RDATA[pos]);
+        } else
+            ss << inet_ntoa(*((in_addr *)i->RDATA));
+        ss << "\')";
+    }
     
     return os << ss.str() << "]";
 }
@@ -296,6 +317,18 @@ DnsMessage::ResourceRecord::ResourceRecord(const std::string& name, const struct
     memcpy(RDATA, (void *)&resolvedaddress, RDLENGTH);
 }
 
+DnsMessage::ResourceRecord::ResourceRecord(const std::string& name, const std::string& resolvedname) throw (SerializeException)
+    : NAME(name),
+      TYPE(TYPE_PTR),
+      CLASS(CLASS_IN),
+      TTL(0)
+{
+    char encoded[256];
+    RDLENGTH = serialize_qname(resolvedname, encoded, sizeof(encoded));
+    RDATA = new char[RDLENGTH];
+    memcpy(RDATA, encoded, RDLENGTH);
+}
+
 DnsMessage::ResourceRecord::ResourceRecord(const ResourceRecord& src)
     : NAME(src.NAME),
       TYPE(src.TYPE),
@@ -317,46 +350,6 @@ DnsMessage::DnsException::DnsException(const uint16_t ID, char RCODE, const char
 
 DnsMessage::SerializeException::SerializeException(const char* s) : std::runtime_error(s){}
 
-// DnsResponse subclass
-
-DnsResponse::DnsResponse(const DnsMessage& q, DnsResolver& resolver, size_t maxmessage) throw (DnsException)
-    : DnsMessage(),query(q) {
-    ID = q.ID;
-    QR = true;
-    OPCODE = q.OPCODE;
-    AA = true; // We're an authority on this matter
-    // TC: will be calculated later
-    RCODE = DnsResponse::NO_ERROR;
-    RD = q.RD;
-    RA = false;
-    Z = q.Z;
-
-    // keep the same questions
-    questions.assign(query.questions.begin(), query.questions.end());
-
-    // ctrace << "\t(DnsResponse: query.questions.size() is " << query.questions.size() << endl;
-
-    for (list<DnsQuestion>::iterator iter =  questions.begin(); iter != questions.end(); iter++){
-        // provide answers using resolver
-        try {
-            // ctrace << "\t(DnsResponse: this is iter->QNAME " << iter->QNAME << endl;
-            const addr_set_t* result = resolver.resolve(iter->QNAME);
-            for (addr_set_t::iterator jter = result->begin(); jter != result->end() ; jter++){
-                ResourceRecord record(iter->QNAME,*jter);
-                answers.push_back(record);
-            }
-        } catch (DnsResolver::ResolveException &e) {
-            cwarning << "Exception resolving \'" << iter->QNAME << "\', handling..." << endl;
-        }
-    }
-    if (answers.size() == 0){
-        throw DnsException(ID, DnsErrorResponse::NAME_ERROR, TRACELINE("Could not resolve any of the questions"));
-    }
-    TC = false;
-}
-
-DnsResponse::~DnsResponse(){}
-
 // DnsErrprResponse subclass
 
 DnsErrorResponse::DnsErrorResponse(uint16_t _ID, const char _RCODE) throw ()
@@ -373,3 +366,267 @@ DnsErrorResponse::DnsErrorResponse(const DnsException& e) throw ()
     QR = true;
     RCODE = e.errorRCODE;
 }
+
+// DnsQuery class
+
+// a short in network order, wherever it is in the message
+static uint16_t read_short(const char* p){
+    return ((unsigned char) p[0] << 8) | (unsigned char) p[1];
+}
+
+DnsQuery::DnsQuery(const char* data, size_t l) throw (DnsMessage::DnsException)
+    : buff(data), len(l) {
+    if (len < 12) throw DnsMessage::DnsException(0, DnsErrorResponse::FORMAT_ERROR, TRACELINE("Buffer to small to hold DNS header"));
+
+    id = read_short(&buff[0]);
+
+    if (buff[2] & 0x80) throw DnsMessage::DnsException(id, DnsErrorResponse::FORMAT_ERROR, TRACELINE("Uhhh. Client talking back to the server"));
+
+    if (buff[2] & 0x78) throw DnsMessage::DnsException(id, DnsErrorResponse::NOT_IMPLEMENTED, TRACELINE("Only simple QUERY operation supported"));
+
+    if (buff[2] & 0x04) throw DnsMessage::DnsException(id, DnsErrorResponse::FORMAT_ERROR, TRACELINE("Client thinks he's some kind of authority"));
+
+    if (buff[2] & 0x02) throw DnsMessage::DnsException(id, DnsErrorResponse::FORMAT_ERROR, TRACELINE("Client sent a truncated message, why?"));
+
+    rd = buff[2] & 0x01;
+
+    if (buff[3] & 0x80) throw DnsMessage::DnsException(id, DnsErrorResponse::FORMAT_ERROR, TRACELINE("Nice to know the client has recursion"));
+
+    z = (buff[3] & 0x70) >> 3;
+
+    qdcount = read_short(&buff[4]);
+    ancount = read_short(&buff[6]);
+    nscount = read_short(&buff[8]);
+    arcount = read_short(&buff[10]);
+
+    if (qdcount > MAX_QUESTIONS)
+        throw DnsMessage::DnsException(id, DnsErrorResponse::FORMAT_ERROR, TRACELINE("Too many questions"));
+
+    size_t pos = 12;
+    for (unsigned int i = 0; i < qdcount; i++) {
+        Question& question = questions[i];
+        question.wire = &buff[pos];
+        pos = parse_name(pos, question.key, question.keylen);
+        question.wirelen = &buff[pos] - question.wire;
+        // lowercase all labels in one go, hashing each word as it is lowercased
+        question.hash = lowercase_helper(question.key, question.key, question.keylen);
+        question.key[question.keylen] = '\0';
+        if (pos + 4 > len)
+            throw DnsMessage::DnsException(id, DnsErrorResponse::FORMAT_ERROR, TRACELINE("So many questions, so little buffer space!"));
+        questions[i].qtype = read_short(&buff[pos]);
+        questions[i].qclass = read_short(&buff[pos + 2]);
+        pos += 4;
+    }
+    end = pos;
+
+    // the other sections are checked as thoroughly, but only an OPT record
+    // in the additional one is kept
+    edns = false;
+    payload = 0;
+    version = 0;
+    for (unsigned int i = 0; i < (unsigned int) ancount + nscount + arcount; i++) {
+        char name[MAX_NAME + 1];
+        size_t namelen;
+        pos = parse_name(pos, name, namelen);
+        if (pos + 10 > len)
+            throw DnsMessage::DnsException(id, DnsErrorResponse::FORMAT_ERROR, TRACELINE("Resource record runs past the end of the message"));
+        uint16_t type = read_short(&buff[pos]);
+        uint16_t rdlength = read_short(&buff[pos + 8]);
+        if (pos + 10 + rdlength > len)
+            throw DnsMessage::DnsException(id, DnsErrorResponse::FORMAT_ERROR, TRACELINE("Resource data runs past the end of the message"));
+        if (type == DnsMessage::TYPE_OPT && i >= (unsigned int) ancount + nscount) {
+            if (edns)
+                throw DnsMessage::DnsException(id, DnsErrorResponse::FORMAT_ERROR, TRACELINE("More than one OPT record"));
+            if (namelen != 0)
+                throw DnsMessage::DnsException(id, DnsErrorResponse::FORMAT_ERROR, TRACELINE("OPT record for a name other than the root"));
+            edns = true;
+            // the class is the payload, the ttl the extended RCODE,
+            // version and flags
+            payload = read_short(&buff[pos + 2]);
+            version = buff[pos + 5];
+        }
+        pos += 10 + rdlength;
+    }
+}
+
+DnsQuery::DnsQuery(const DnsQuery& src){} // private copy constructor does nothing
+
+//  use this example for reference
+//
+//              8 m y d o m a i n 3 c o m 0
+//              0 1 2 3 4 5 6 7 8 9 a b c d
+//              m y d o m a i n . c o m 0
+//
+// Pointers must point back, before the piece of name they're found in, so
+// following them always ends: a name may be made of several pieces this
+// way, but it's still no longer than MAX_NAME. The position returned is
+// right after the first pointer, if any
+size_t DnsQuery::parse_name(size_t pos, char* key, size_t& keylen) const throw (DnsMessage::DnsException){
+    size_t next = 0;
+    size_t piece = pos;
+    keylen = 0;
+    while (true) {
+        if (pos >= len)
+            throw DnsMessage::DnsException(id, DnsErrorResponse::FORMAT_ERROR, TRACELINE("Domain name runs past the end of the message"));
+        size_t label_len = (unsigned char) buff[pos];
+        // the end label
+        if (label_len == 0)
+            break;
+        // a compression pointer, the rest of the name is elsewhere
+        if ((label_len & 0xC0) == 0xC0) {
+            if (pos + 2 > len)
+                throw DnsMessage::DnsException(id, DnsErrorResponse::FORMAT_ERROR, TRACELINE("Compression pointer runs past the end of the message"));
+            size_t target = ((label_len & 0x3F) << 8) | (unsigned char) buff[pos + 1];
+            if (target < 12 || target >= piece)
+                throw DnsMessage::DnsException(id, DnsErrorResponse::FORMAT_ERROR, TRACELINE("Compression pointer doesn't point back"));
+            if (next == 0)
+                next = pos + 2;
+            pos = piece = target;
+            continue;
+        }
+        // check if the topmost two bits are 00 as required
+        if ((label_len & 0xC0) != 0)
+            throw DnsMessage::DnsException(id, DnsErrorResponse::FORMAT_ERROR, TRACELINE("Unknown domain label type"));
+        if (pos + 1 + label_len > len)
+            throw DnsMessage::DnsException(id, DnsErrorResponse::FORMAT_ERROR, TRACELINE("One label mentions more characters than exist"));
+        if (keylen + (keylen > 0) + label_len > MAX_NAME)
+            throw DnsMessage::DnsException(id, DnsErrorResponse::FORMAT_ERROR, TRACELINE("Domain name too long"));
+        if (keylen > 0)
+            key[keylen++] = '.';
+        memcpy(&key[keylen], &buff[pos + 1], label_len);
+        keylen += label_len;
+        pos += 1 + label_len;
+    }
+    return next ? next : pos + 1;
+}
+
+size_t DnsQuery::udp_size(size_t max) const {
+    size_t size = UdpSocket::DEFAULT_MAX_MSG;
+    if (edns && payload > size)
+        size = payload;
+    return (size < max) ? size : max;
+}
+
+// The response keeps the query's header and questions where they are, and
+// drops any other section of it but for an OPT record, which it answers
+// with its own. Names in answers point back at the questions, or at each
+// other, wherever they can. Questions are answered whole or not at all:
+// the first whose answers don't fit and all after it are left out, and TC
+// tells the client to ask again over TCP
+size_t DnsQuery::respond(DnsResolver& resolver, char* response, size_t buflen) const throw (DnsMessage::SerializeException){
+    size_t opt = edns ? OPT_SIZE : 0;
+    if (buflen < end + opt)
+        throw DnsMessage::SerializeException("Not enough space for questions");
+    if (response != buff)
+        memcpy(response, buff, end);
+    size_t room = buflen - opt;
+
+    DnsMessage::NameTable names;
+    for (unsigned int i = 0; i < qdcount; i++)
+        names.add(response, questions[i].wire - buff);
+
+    size_t pos = end;
+    uint16_t nanswers = 0;
+    bool truncated = false;
+    // versions we don't know get no answers, only BADVERS
+    for (unsigned int i = 0; i < qdcount && version == 0; i++) {
+        size_t start = pos;
+        try {
+            if (questions[i].qtype == DnsMessage::TYPE_PTR)
+                nanswers += answer_ptr(resolver, questions[i], names, response, room, pos);
+            else
+                nanswers += answer_a(resolver, questions[i], response, room, pos);
+        } catch (DnsResolver::ResolveException &e) {
+            cwarning << "Exception resolving \'" << questions[i].key << "\', handling..." << endl;
+        } catch (DnsMessage::SerializeException &e) {
+            ctrace << "Answers to \'" << questions[i].key << "\' won't fit in " << buflen << " bytes, truncating..." << endl;
+            pos = start;
+            truncated = true;
+            break;
+        }
+    }
+
+    // QR and AA, we're an authority on this matter, TC if answers were left
+    // out, RD as asked. Names that aren't there are a normal answer, not an
+    // error
+    response[2] = 0x80 | 0x04 | (truncated ? 0x02 : 0) | rd;
+    response[3] = (z << 3) | ((nanswers == 0 && !truncated && version == 0) ? DnsErrorResponse::NAME_ERROR : 0);
+    uint16_t network_short = htons(nanswers);
+    memcpy(&response[6], &network_short, 2);
+    memset(&response[8], 0, 4);
+
+    // the OPT record: root name, type, our payload, the upper bits of the
+    // RCODE, 1 for BADVERS, version 0, no flags and no data
+    if (edns) {
+        uint16_t type = htons(DnsMessage::TYPE_OPT);
+        uint16_t size = htons(EDNS_PAYLOAD);
+        response[pos] = 0;
+        memcpy(&response[pos + 1], &type, 2);
+        memcpy(&response[pos + 3], &size, 2);
+        memset(&response[pos + 5], 0, 6);
+        if (version != 0)
+            response[pos + 5] = 1;
+        pos += OPT_SIZE;
+        response[11] = 1;
+    }
+    return pos;
+}
+
+// straight from the resolver into the response, the records only need to
+// point at the right question
+uint16_t DnsQuery::answer_a(DnsResolver& resolver, const Question& question, char* response, size_t buflen, size_t& pos) const throw (DnsMessage::SerializeException, DnsResolver::ResolveException){
+    size_t count = 0;
+    char* records = &response[pos];
+    if (!resolver.resolve(string(question.key, question.keylen), question.hash, records, buflen - pos, count))
+        return 0;
+    if (count > (buflen - pos) / DnsResolver::ANSWER_RECORD_SIZE)
+        throw DnsMessage::SerializeException("Not enough space for answer records");
+    size_t offset = question.wire - buff;
+    if (offset != 12)
+        for (size_t i = 0; i < count; i++) {
+            records[i * DnsResolver::ANSWER_RECORD_SIZE] = 0xC0 | (offset >> 8);
+            records[i * DnsResolver::ANSWER_RECORD_SIZE + 1] = offset & 0xFF;
+        }
+    pos += count * DnsResolver::ANSWER_RECORD_SIZE;
+    return count;
+}
+
+// owners point at the question, names at the longest suffix any earlier
+// name has in common with them
+uint16_t DnsQuery::answer_ptr(DnsResolver& resolver, const Question& question, DnsMessage::NameTable& names, char* response, size_t buflen, size_t& pos) const throw (DnsMessage::SerializeException, DnsResolver::ResolveException){
+    struct in_addr address;
+    name_list_t resolved;
+    if (!DnsMessage::parse_reverse_name(string(question.key, question.keylen), address) || !resolver.resolve_address(address, resolved))
+        return 0;
+
+    uint16_t offset = htons(0xC000 | (question.wire - buff));
+    uint16_t type = htons(DnsMessage::TYPE_PTR);
+    uint16_t klass = htons(DnsMessage::CLASS_IN);
+    uint32_t ttl = 0;
+    uint16_t count = 0;
+    for (name_list_t::iterator iter = resolved.begin(); iter != resolved.end(); iter++) {
+        if (!DnsMessage::valid_name(*iter)) {
+            cwarning << "Name \'" << *iter << "\' too long for a PTR record, skipping..." << endl;
+            continue;
+        }
+        if (pos + 12 > buflen)
+            throw DnsMessage::SerializeException("Not enough space for PTR record");
+        size_t len = names.write(*iter, response, pos + 12, buflen);
+        uint16_t rdlength = htons(len);
+        memcpy(&response[pos], &offset, 2);
+        memcpy(&response[pos + 2], &type, 2);
+        memcpy(&response[pos + 4], &klass, 2);
+        memcpy(&response[pos + 6], &ttl, 4);
+        memcpy(&response[pos + 10], &rdlength, 2);
+        pos += 12 + len;
+        count++;
+    }
+    return count;
+}
+
+std::ostream& operator<<(std::ostream& os, const DnsQuery& q){
+    os << "[DnsQuery: ID= \'" << hex << q.id << dec << "\' questions= \'" << q.qdcount << "\' ";
+    for (unsigned int i = 0; i < q.qdcount; i++)
+        os << "(q= \'" << q.questions[i].key << "\')";
+    return os << "]";
+}
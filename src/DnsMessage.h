@@ -14,6 +14,7 @@
 #include "Thread.h"
 
 class DnsErrorResponse;
+class DnsQuery;
 class DnsMessage {
 public:
     // DnsException - signals a problem
@@ -32,7 +33,6 @@ public:
     };
     
     // Constructors and destructors
-    DnsMessage(char* buff, const size_t size) throw (DnsException);
     DnsMessage();
     virtual ~DnsMessage();
     void deleteRecords();
@@ -42,21 +42,47 @@ public:
     // Serialize stuff
     size_t serialize(char* buff, const size_t len) throw (SerializeException);
 
-    // friends - while DnsResponse inherits from DnsMessage, this is still
-    // needed to have it modify private fields of another, pure DnsMessage
-    // instance
-    friend class DnsResponse;
+    // friends - DnsQuery answers queries in place with the constants and
+    // name helpers below
+    friend class DnsQuery;
 
 private:
     DnsMessage(DnsMessage& src);
 
 protected:
-    size_t parse_qname(const char* buff, size_t buflen, char* resulting_thing);
     static size_t serialize_qname(const std::string& qname, char* resulting_thing, size_t buflen) throw (SerializeException);
+    // qname can be written as a name: no label longer than 63, not longer
+    // than 253 in all
+    static bool valid_name(const std::string& qname);
+    // the address asked for by a PTR question, false if qname isn't a full
+    // in-addr.arpa name
+    static bool parse_reverse_name(const std::string& qname, struct in_addr& address);
 
     // friends
     friend std::ostream& operator<<(std::ostream& os, const DnsMessage& msg);
 
+    // NameTable nested class, where names already are in a message, for RFC
+    // 1035 compression: the offsets of up to MAX_LABELS labels, each the
+    // start of a name that later names may point to. Allocates nothing.
+    class NameTable {
+    public:
+        NameTable();
+        // the name at offset of message, up to its end or a pointer
+        void add(const char* message, size_t offset);
+        // write name, dotted, at pos of message as its first labels and a
+        // pointer to the longest of its suffixes already there, and add it.
+        // Returns the length written
+        size_t write(const std::string& name, char* message, size_t pos, size_t buflen) throw (SerializeException);
+    private:
+        // the name at offset of message, following pointers, is name
+        // from dotted index start on
+        static bool equal(const char* message, size_t offset, const std::string& name, size_t start);
+
+        static const unsigned int MAX_LABELS = 64;
+        uint16_t labels[MAX_LABELS];
+        unsigned int count;
+    };
+
     typedef uint16_t u_int16;
     typedef uint32_t u_int32;
     typedef char u_int4;
@@ -96,7 +122,6 @@ protected:
     std::list<ResourceRecord> additional;
 
     class DnsQuestion {
-        friend class DnsResponse;
         // QNAME(variable, crazy structure): domain name asked for
         std::string QNAME;
         // QTYPE(4 bytes): query type - only DNS_TYPE_A supported
@@ -108,7 +133,8 @@ protected:
         DnsQuestion(const char* domainname, uint16_t _qtype, uint16_t _qclass);
         ~DnsQuestion(){};
         friend std::ostream& operator<<(std::ostream& os, const DnsMessage& msg);
-        size_t serialize(char *buff, const size_t buflen) throw (SerializeException);
+        // at pos of message, its name compressed against names
+        size_t serialize(NameTable& names, char* message, size_t pos, const size_t buflen) throw (SerializeException);
 
         DnsQuestion(const ResourceRecord& src){}
     };
@@ -116,21 +142,24 @@ protected:
         // NAME(variable, crazy structure): domain name the resource record is bound to. defaults to root
         // domain
         std::string NAME;
-        // TYPE(2 bytes): type of this resource record, only TYPE_A(a host address) supported
+        // TYPE(2 bytes): type of this resource record, TYPE_A (a host address)
+        // or TYPE_PTR (a name, for reverse lookups)
         uint16_t TYPE;
         // CLASS(2 bytes): class this resource record is in, only CLASS_IN supported
         uint16_t CLASS;
         // TTL(4 bytes): time in seconds it may be stored in cache. always 0
         uint32_t TTL;
-        // RDLENGTH(2 bytes): length in bytes of data pointed to by RDATA, only 4 is
-        // supported
+        // RDLENGTH(2 bytes): length in bytes of data pointed to by RDATA, 4 for
+        // TYPE_A
         uint16_t RDLENGTH;
         // RDATA: raw binary data for this resource record, in network order
         // already.
         char *RDATA;
     public:
-        size_t serialize(char *buff, const size_t buflen) throw (SerializeException);
+        // at pos of message, its owner name compressed against names
+        size_t serialize(NameTable& names, char* message, size_t pos, const size_t buflen) throw (SerializeException);
         ResourceRecord(const std::string& name, const struct in_addr& resolvedaddress);
+        ResourceRecord(const std::string& name, const std::string& resolvedname) throw (SerializeException);
         ~ResourceRecord();
         friend std::ostream& operator<<(std::ostream& os, const DnsMessage& msg);
         ResourceRecord(const ResourceRecord& src);
@@ -140,16 +169,81 @@ protected:
     // constants
     const static bool QUERY = 0;
     const static bool QUERY_A = 0;
-    const static bool TYPE_A = 1;
-    const static bool CLASS_IN = 1;
+    const static uint16_t TYPE_A = 1;
+    const static uint16_t TYPE_PTR = 12;
+    const static uint16_t TYPE_OPT = 41;
+    const static uint16_t CLASS_IN = 1;
 };
 
-class DnsResponse : public DnsMessage {
-    const DnsMessage& query;
+// DnsQuery, a query as it sits in the receive buffer: its header fields and
+// up to MAX_QUESTIONS questions, whose names point into the buffer. Parsing
+// one allocates nothing, so it is meant to live on the stack, and the buffer
+// must outlive it.
+class DnsQuery {
 public:
-    DnsResponse(const DnsMessage& q, DnsResolver& resolver, const size_t maxresponse) throw (DnsException);
-    ~DnsResponse();
-    const static char NO_ERROR = 0;
+    DnsQuery(const char* buff, size_t len) throw (DnsMessage::DnsException);
+
+    // write the response to response, which may well be the buffer the
+    // query was parsed from: the header and questions are turned around in
+    // place and the answers follow them. Answers past buflen are left out
+    // and the TC bit set. Returns the response's length
+    size_t respond(DnsResolver& resolver, char* response, size_t buflen) const throw (DnsMessage::SerializeException);
+
+    // the largest response the client takes over UDP: 512 bytes, or the
+    // payload it advertised with EDNS0, up to max
+    size_t udp_size(size_t max) const;
+
+    friend std::ostream& operator<<(std::ostream& os, const DnsQuery& query);
+
+    static const unsigned int MAX_QUESTIONS = 8;
+    // longest name, dotted, as RFC 1035 allows
+    static const size_t MAX_NAME = 253;
+    // the UDP payload we advertise with EDNS0, as RFC 6891 suggests when
+    // fragments are to be avoided
+    static const uint16_t EDNS_PAYLOAD = 1232;
+    // the OPT record a response echoes
+    static const size_t OPT_SIZE = 11;
+
+    struct Question {
+        // the name as it is in the buffer, labels ending in a zero or in a
+        // compression pointer
+        const char* wire;
+        size_t wirelen;
+        // the name dotted and in lowercase, what the resolver looks up, and
+        // its hash64_helper()
+        char key[MAX_NAME + 1];
+        size_t keylen;
+        uint64_t hash;
+        uint16_t qtype;
+        uint16_t qclass;
+    };
+
+    const char* buff;
+    size_t len;
+    uint16_t id;
+    bool rd;
+    char z;
+    uint16_t qdcount;
+    uint16_t ancount;
+    uint16_t nscount;
+    uint16_t arcount;
+    // where the question section ends
+    size_t end;
+    Question questions[MAX_QUESTIONS];
+    // whether the additional section had an OPT record, and then the
+    // payload and EDNS version it gave
+    bool edns;
+    uint16_t payload;
+    unsigned char version;
+
+private:
+    DnsQuery(const DnsQuery& src);
+    // the name at pos, following compression pointers, dotted into key,
+    // which holds MAX_NAME + 1. Returns the position after it
+    size_t parse_name(size_t pos, char* key, size_t& keylen) const throw (DnsMessage::DnsException);
+    // append the answers to question at pos, return how many
+    uint16_t answer_a(DnsResolver& resolver, const Question& question, char* response, size_t buflen, size_t& pos) const throw (DnsMessage::SerializeException, DnsResolver::ResolveException);
+    uint16_t answer_ptr(DnsResolver& resolver, const Question& question, DnsMessage::NameTable& names, char* response, size_t buflen, size_t& pos) const throw (DnsMessage::SerializeException, DnsResolver::ResolveException);
 };
 
 class DnsErrorResponse : public DnsMessage {
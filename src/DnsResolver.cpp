@@ -1,6 +1,8 @@
 // libc includes
 
+#include <ctype.h>
 #include <errno.h>
+#include <stdio.h>
 #include <string.h>
 #include <limits.h>
 #include <sys/types.h>
@@ -10,9 +12,11 @@
 // stdl includes
 
 #include <sstream>
+#include <algorithm>
 
 // Project includes
 #include "trace.h"
+#include "helper.h"
 #include "DnsResolver.h"
 
 // usings
@@ -20,45 +24,112 @@
 using namespace std;
 
 // non integral type constant setting
-const unsigned int DnsResolver::DEFAULT_CACHE_SIZE[3] = {20, 1, INT_MAX};
+const unsigned int DnsResolver::DEFAULT_CACHE_SIZE[3] = {20, 1, 1 << 24};
+const unsigned int DnsResolver::DEFAULT_CACHE_SHARDS[3] = {8, 1, 1024};
+const DnsResolver::CachePolicy DnsResolver::DEFAULT_CACHE_POLICY = DnsResolver::CACHE_LRU;
+const char* const DnsResolver::CACHE_POLICY_NAMES[DnsResolver::CACHE_POLICIES] = {"lru", "clock", "tinylfu", "arc"};
+const unsigned int DnsResolver::DEFAULT_NEGATIVE_CACHE_SIZE[3] = {256, 0, 1 << 24};
 const unsigned int DnsResolver::DEFAULT_MAX_ALIASES[3] = {5, 1, 512};
 const unsigned int DnsResolver::DEFAULT_MAX_INVERSE_ALIASES[3] = {5, 1, 512};
 const bool DnsResolver::DEFAULT_NOSTATFLAG = false;
+const bool DnsResolver::DEFAULT_INDEXFLAG = false;
+const bool DnsResolver::DEFAULT_PERFECTFLAG = false;
+const unsigned int DnsResolver::DEFAULT_LOAD_THREADS[3] = {4, 1, 64};
+
+// retired cache entries are freed in batches of this many
+static const size_t COLLECT_THRESHOLD = 1024;
+
+// first line of a cache dump, dumps without it are ignored
+static const char CACHE_DUMP_HEADER[] = "# minns cache dump 1";
+
+// everything but the address of an answer record: the name at offset 12,
+// type A, class IN, a zero ttl, four bytes of data
+static const unsigned char ANSWER_PREFIX[12] = {0xC0, 0x0C, 0, 1, 0, 1, 0, 0, 0, 0, 0, 4};
+
+static inline void answer_record(char* record, struct in_addr ip){
+    memcpy(record, ANSWER_PREFIX, sizeof(ANSWER_PREFIX));
+    memcpy(record + sizeof(ANSWER_PREFIX), &ip, sizeof(ip));
+}
+
+static inline struct in_addr answer_address(const char* record){
+    struct in_addr ip;
+    memcpy(&ip, record + sizeof(ANSWER_PREFIX), sizeof(ip));
+    return ip;
+}
 
 DnsResolver::DnsResolver(
     const std::string& _filename,
-    const unsigned int maxsize,
+    const unsigned int _maxsize,
     const unsigned int maxa,
-    const unsigned int maxialiases,
-    const bool _nostatflag) throw (ResolveException)
-    : maxaliases(maxa), filename(_filename), nostatflag(_nostatflag)
+    const unsigned int _maxialiases,
+    const bool _nostatflag,
+    const bool _indexflag,
+    const unsigned int _shards,
+    const CachePolicy _policy,
+    const unsigned int _negsize,
+    const bool _perfectflag,
+    const unsigned int _loadthreads) throw (ResolveException)
+    : maxsize(_maxsize), shards(_shards), policy(_policy), negsize(_negsize), maxaliases(maxa), maxialiases(_maxialiases),
+      filename(_filename), nostatflag(_nostatflag), indexflag(_indexflag || _perfectflag),
+      perfectflag(_perfectflag), loadthreads(_loadthreads),
+      current(NULL), reload_pending(0), collect_pending(0),
+      reloader(*this), reloader_thread(reloader),
+      watcher(_filename, reloader), watcher_thread(watcher)
 {
+    // ARC keeps as many ghosts as entries. Better refuse here than fail to
+    // allocate it all, or go swapping
+    uint64_t bytes = (uint64_t) maxsize * Store::entry_size(maxialiases) * ((policy == CACHE_ARC) ? 2 : 1) +
+        (uint64_t) negsize * Store::entry_size(0);
+    if (bytes > MAX_CACHE_BYTES) {
+        stringstream ss;
+        ss << "A cache of " << maxsize << " names with up to " << maxialiases << " addresses each needs "
+           << (bytes >> 20) << " MB, more than the " << (MAX_CACHE_BYTES >> 20) << " MB allowed";
+        throw ResolveException(ss.str().c_str());
+    }
 
-    struct stat filestat;
-    if ((stat(_filename.c_str(), &filestat) != 0))
-        throw ResolveException(string(TRACELINE("Could not stat() \'") + filename + "\'").c_str());
+    // watch before loading, so that no change goes unnoticed
+    if (!nostatflag)
+        watcher.setup();
 
-    file = new ifstream(filename.c_str(), ios::in);
-    if (file->fail()){
-        delete file;
-        throw ResolveException(string(TRACELINE("Could not open \'") + filename + "\'").c_str());
-    }
+    // the first snapshot is built right away, so that errors reach the caller
+    current = load_snapshot();
 
-    cache = new Cache(maxsize, maxialiases, filestat.st_mtime);
+    try {
+        reloader_thread.run();
+    } catch (Thread::ThreadException& e) {
+        delete current;
+        throw ResolveException(e.what());
+    }
+    if (!nostatflag) {
+        try {
+            watcher_thread.run();
+        } catch (Thread::ThreadException& e) {
+            reloader.stop();
+            reloader_thread.join(NULL);
+            delete current;
+            throw ResolveException(e.what());
+        }
+    }
 }
 
 
 DnsResolver::~DnsResolver(){
-    file->close();
-    delete file;
-    delete cache;
+    if (!nostatflag) {
+        watcher.stop();
+        watcher_thread.join(NULL);
+    }
+    reloader.stop();
+    reloader_thread.join(NULL);
+    delete current;
 }
 
 string DnsResolver::resolve_to_string(const string& what) throw (ResolveException){
     static char buff[INET_ADDRSTRLEN];
     stringstream ss;
 
-    addr_set_t result(*resolve(what));
+    addr_set_t result;
+    if (!resolve(what, result))
+        throw ResolveException(string("Could not resolve \'" + what + "\'").c_str());
 
     for (addr_set_t::iterator iter = result.begin(); iter != result.end() ; iter++){
         struct in_addr temp = *iter;
@@ -73,191 +144,1912 @@ string DnsResolver::resolve_to_string(const string& what) throw (ResolveExceptio
     return string(ss.str());
 }
 
-const addr_set_t* DnsResolver::resolve(const std::string& name) throw (ResolveException) {
-    const addr_set_t* result=NULL;
+bool DnsResolver::resolve(const std::string& name, addr_set_t& result) throw (ResolveException) {
+    string lower(name);
+    uint64_t hash = lower.empty() ? hash64_helper("", 0) : lowercase_helper(&lower[0], name.data(), name.size());
+    return resolve(lower, hash, result);
+}
 
-    if (!nostatflag) {
-        struct stat filestat;
-        if (stat(filename.c_str(), &filestat) != 0)
-            throw ResolveException(string(TRACELINE("Could not stat() \'") + filename + "\'").c_str());
-        if (filestat.st_mtime != cache->get_file_mtime()){
-            cwarning << "File modification time has changed, clearing cache\n" << endl;
-            size_t size = cache->get_maxsize();
-            size_t ialias = cache->get_maxialiases();
-            delete cache;
-            cache = new Cache(size, ialias, filestat.st_mtime);
-            goto search;
-        }
-    }
-    result = cache->lookup(name);
-    if (result != NULL) {
-        ctrace <<  "\t(Cache HIT! for \'" << name << "\')\n";
-        return result;
-    } else {
-        cwarning <<  "\t(Cache MISS for \'" << name << "\')\n";
+bool DnsResolver::resolve(const std::string& name, uint64_t hash, addr_set_t& result) throw (ResolveException) {
+    bool found;
+    unsigned int epoch = rcu.read_lock();
+    try {
+        Snapshot* snapshot = current;
+        found = search(snapshot, name, hash, result);
+        // wildcards only answer for names that aren't there, and are never
+        // cached
+        if (!found && snapshot->wildcards != NULL && snapshot->wildcards->lookup(name, result)) {
+            wildhits.add();
+            ctrace << "\t(Wildcard HIT for \'" << name << "\')" << endl;
+            found = true;
+        }
+    } catch (ResolveException& e) {
+        rcu.read_unlock(epoch);
+        throw e;
+    } catch (Thread::ThreadException& e) {
+        rcu.read_unlock(epoch);
+        throw ResolveException(e.what());
+    }
+    rcu.read_unlock(epoch);
+
+    if (rcu.retired() > COLLECT_THRESHOLD)
+        reloader.collect();
+    return found;
+}
+
+// a cache hit is a single copy of the records, anything else is answered
+// from the addresses found
+bool DnsResolver::resolve(const std::string& name, uint64_t hash, char* answers, size_t buflen, size_t& count) throw (ResolveException) {
+    uint32_t hash32 = (uint32_t) hash;
+    bool found = false, cached = false;
+    addr_set_t result;
+    unsigned int epoch = rcu.read_lock();
+    try {
+        Snapshot* snapshot = current;
+        if (!snapshot->filter->contains(hash32)) {
+            filterhits.add();
+            ctrace << "\t(Filtered out \'" << name << "\')" << endl;
+        } else if (snapshot->cache->lookup(name, hash32, answers, buflen, count)) {
+            hits.add();
+            ctrace <<  "\t(Cache HIT! for \'" << name << "\')\n";
+            cached = found = true;
+        } else {
+            found = fetch(snapshot, name, hash, result);
+        }
+        if (!found && snapshot->wildcards != NULL && snapshot->wildcards->lookup(name, result)) {
+            wildhits.add();
+            ctrace << "\t(Wildcard HIT for \'" << name << "\')" << endl;
+            found = true;
+        }
+    } catch (ResolveException& e) {
+        rcu.read_unlock(epoch);
+        throw e;
+    } catch (Thread::ThreadException& e) {
+        rcu.read_unlock(epoch);
+        throw ResolveException(e.what());
+    }
+    rcu.read_unlock(epoch);
+
+    if (rcu.retired() > COLLECT_THRESHOLD)
+        reloader.collect();
+    if (cached)
+        return true;
+    count = result.size();
+    size_t room = buflen / ANSWER_RECORD_SIZE;
+    for (addr_set_t::const_iterator iter = result.begin(); iter != result.end() && room > 0; iter++, room--) {
+        answer_record(answers, *iter);
+        answers += ANSWER_RECORD_SIZE;
+    }
+    return found;
+}
+
+bool DnsResolver::resolve_address(const struct in_addr& address, name_list_t& result) throw (ResolveException) {
+    bool found;
+    unsigned int epoch = rcu.read_lock();
+    Snapshot* snapshot = current;
+    if (snapshot->image != NULL)
+        found = snapshot->image->lookup_address(address, result);
+    else
+        found = snapshot->reverse->lookup(address, result);
+    rcu.read_unlock(epoch);
+    ctrace << "\t(Reverse " << (found ? "HIT" : "MISS") << " for \'" << inet_ntoa(address) << "\')" << endl;
+    return found;
+}
+
+size_t DnsResolver::save_cache(const std::string& path) throw (ResolveException) {
+    vector<string> names;
+    unsigned int epoch = rcu.read_lock();
+    try {
+        current->cache->names(names);
+    } catch (Thread::ThreadException& e) {
+        rcu.read_unlock(epoch);
+        throw ResolveException(e.what());
     }
+    rcu.read_unlock(epoch);
 
-search:
-    // search the file
-    file->clear();
-    file->seekg(0, ios::beg);
+    // readers of path see either the old dump or the whole new one
+    string temp = path + ".tmp";
+    ofstream out(temp.c_str(), ios::out | ios::trunc);
+    out << CACHE_DUMP_HEADER << "\n";
+    for (size_t i = 0; i < names.size(); i++)
+        out << names[i] << "\n";
+    out.close();
+    if (out.fail()) {
+        unlink(temp.c_str());
+        throw ResolveException(TRACELINE("Could not write cache dump"));
+    }
+    if (rename(temp.c_str(), path.c_str()) != 0) {
+        unlink(temp.c_str());
+        throw ResolveException(TRACELINE("Could not rename() cache dump"));
+    }
+    ctrace << "\t(Saved " << names.size() << " cached names to \'" << path << "\')" << endl;
+    return names.size();
+}
+
+// anything a query could have cached: no blanks, no control characters
+static bool dumped_name(const string& name){
+    if (name.empty() || name.size() > DnsResolver::MAX_NAME)
+        return false;
+    for (size_t i = 0; i < name.size(); i++)
+        if ((unsigned char) name[i] <= ' ' || (unsigned char) name[i] == 0x7f)
+            return false;
+    return true;
+}
+
+size_t DnsResolver::warm_cache(const std::string& path) throw (ResolveException) {
+    ifstream in(path.c_str());
+    if (!in) {
+        ctrace << "\t(No cache dump at \'" << path << "\')" << endl;
+        return 0;
+    }
     string line;
-    while (getline(*file, line)){
-        // cerr << " got line \'" << line << "\'" << endl;
-        DnsEntry parsed;
-        if (parse_line(line, parsed) != -1){
-            for (list<string>::iterator iter=parsed.aliases.begin(); iter != parsed.aliases.end(); iter++){
-                if (name.compare(*iter) == 0){
-                    ctrace << "\t(File HIT for \'" << *iter << "\' inserted into cache )" << endl;
-                    result = cache->insert(*iter, parsed.ip);
-                } else if (!cache->full()) {
-                    ctrace << "\t(Inserting \'" << *iter << "\' into cache anyway )" << endl;
-                    cache->insert(*iter, parsed.ip);
-                } else {
-                    cwarning << "\t(Cache is full \'" << *iter << "\' not inserted)" << endl;
+    if (!getline(in, line) || line != CACHE_DUMP_HEADER) {
+        cwarning << "Ignoring \'" << path << "\', not a cache dump" << endl;
+        return 0;
+    }
+    vector<string> names;
+    size_t skipped = 0;
+    while (names.size() < maxsize && getline(in, line)) {
+        if (dumped_name(line))
+            names.push_back(line);
+        else
+            skipped++;
+    }
+    if (skipped > 0)
+        cwarning << "Skipped " << skipped << " bad lines in \'" << path << "\'" << endl;
+
+    // the least recently used first, so that the dump's order survives. A
+    // stale name just misses, and warming up counts for no statistics
+    long before[5] = {hits.value(), misses.value(), neghits.value(), filterhits.value(), wildhits.value()};
+    size_t found = 0;
+    for (size_t i = names.size(); i-- > 0; ) {
+        addr_set_t result;
+        if (resolve(names[i], result))
+            found++;
+    }
+    hits.add(before[0] - hits.value());
+    misses.add(before[1] - misses.value());
+    neghits.add(before[2] - neghits.value());
+    filterhits.add(before[3] - filterhits.value());
+    wildhits.add(before[4] - wildhits.value());
+    ctrace << "\t(Warmed cache with " << found << " of " << names.size() << " names in \'" << path << "\')" << endl;
+    return found;
+}
+
+// name is in lowercase, as is everything the tables below compare it to,
+// except for the file itself in index mode
+bool DnsResolver::search(Snapshot* snapshot, const std::string& name, uint64_t hash, addr_set_t& result) throw (ResolveException, Thread::ThreadException) {
+    uint32_t hash32 = (uint32_t) hash;
+
+    // names that are definitely not in the file touch nothing else
+    if (!snapshot->filter->contains(hash32)) {
+        filterhits.add();
+        ctrace << "\t(Filtered out \'" << name << "\')" << endl;
+        return false;
+    }
+
+    Cache* cache = snapshot->cache;
+    if (cache->lookup(name, hash32, result)) {
+        hits.add();
+        ctrace <<  "\t(Cache HIT! for \'" << name << "\')\n";
+        return true;
+    }
+    return fetch(snapshot, name, hash, result);
+}
+
+// a name that passed the filter and missed the cache
+bool DnsResolver::fetch(Snapshot* snapshot, const std::string& name, uint64_t hash, addr_set_t& result) throw (ResolveException, Thread::ThreadException) {
+    uint32_t hash32 = (uint32_t) hash;
+    Cache* cache = snapshot->cache;
+    misses.add();
+    cwarning <<  "\t(Cache MISS for \'" << name << "\')\n";
+
+    // so is a miss on an image, answered straight from its mapping
+    if (snapshot->image != NULL) {
+        const struct in_addr* ips;
+        uint32_t naddrs;
+        if (!snapshot->image->lookup(name, hash32, ips, naddrs))
+            return false;
+        ctrace << "\t(Image HIT for \'" << name << "\' inserted into cache )" << endl;
+        for (uint32_t i = 0; i < naddrs; i++) {
+            result.insert(ips[i]);
+            cache->insert(name, hash32, ips[i]);
+        }
+        return true;
+    }
+
+    // in index mode a miss is a single hash lookup, the file is never touched
+    if (snapshot->index != NULL) {
+        if (!snapshot->index->lookup(name, hash, result))
+            return false;
+        ctrace << "\t(Index HIT for \'" << name << "\' inserted into cache )" << endl;
+        for (addr_set_t::const_iterator iter = result.begin(); iter != result.end(); iter++)
+            cache->insert(name, hash32, *iter);
+        return true;
+    }
+
+    // a name the file was already scanned for in vain
+    if (snapshot->negative != NULL && snapshot->negative->lookup(name, hash32)) {
+        neghits.add();
+        ctrace << "\t(Negative cache HIT for \'" << name << "\')" << endl;
+        return false;
+    }
+
+    // search the file. Scans run concurrently, each with its own tokenizer
+    bool found = false;
+    HostsFile::Tokenizer tokenizer(snapshot->file->begin(), snapshot->file->end(), maxaliases);
+    HostsFile::Record record;
+    while (!found && tokenizer.next(record)) {
+        for (size_t i = 0; i < record.names.size(); i++) {
+            const HostsFile::Span& alias = record.names[i];
+            if (alias.len == name.size() && nocase_equal_helper(alias.ptr, name.data(), alias.len)) {
+                ctrace << "\t(File HIT for \'" << name << "\' inserted into cache )" << endl;
+                cache->insert(name, hash32, record.ip);
+                result.insert(record.ip);
+                found = true;
+            } else if (alias.len <= MAX_NAME) {
+                // if its shard has room, insert into cache anyway. The hash
+                // ignores case, so a full cache costs no copy and no lock
+                uint32_t h = (uint32_t) hash64_helper(alias.ptr, alias.len);
+                if (cache->has_room(h)) {
+                    string lower(alias.ptr, alias.len);
+                    lowercase_helper(&lower[0], alias.ptr, alias.len);
+                    cache->insert(lower, h, record.ip, false);
                 }
             }
-            if (result != NULL) break;
         }
     }
-    if (result == NULL)
-        throw ResolveException(string("Could not resolve \'" + name + "\'").c_str());
-    return result;
+    if (!found && snapshot->negative != NULL)
+        snapshot->negative->insert(name, hash32);
+    return found;
 }
 
-int DnsResolver::parse_line(const std::string& line, DnsEntry& parsed) throw (ResolveException){
-    if (line[0] == '#') return -1; // a # denotes a comment
+// Build a complete snapshot of the file as it is now. The file is reopened so
+// that a hosts file replaced by rename() is also picked up.
+DnsResolver::Snapshot* DnsResolver::load_snapshot(bool withcache) throw (ResolveException){
+    Snapshot* fresh = new Snapshot();
+    try {
+        if (HostsImage::is_image(filename)) {
+            fresh->image = new HostsImage(filename);
+            ctrace << "\t(Mapped " << fresh->image->size() << " names from image \'" << filename << "\')" << endl;
+            fresh->filter = &fresh->image->filter();
+            fresh->wildcards = new WildcardTrie(maxialiases);
+            for (size_t i = 0; i < fresh->image->wildcard_count(); i++) {
+                const char* name;
+                size_t len;
+                const struct in_addr* ips;
+                uint32_t naddrs;
+                if (!fresh->image->wildcard(i, name, len, ips, naddrs))
+                    continue;
+                for (uint32_t j = 0; j < naddrs; j++)
+                    fresh->wildcards->add(name, len, ips[j]);
+            }
+        } else if (indexflag) {
+            HostsFile* hosts = new HostsFile(filename);
+            fresh->reverse = new ReverseIndex(maxaliases);
+            fresh->wildcards = new WildcardTrie(maxialiases);
+            fresh->index = new Index(hosts, maxaliases, maxialiases, *fresh->reverse, *fresh->wildcards, perfectflag,
+                                     loadthreads);
+            ctrace << "\t(Indexed " << fresh->index->size() << " names from \'" << filename << "\')" << endl;
+            BloomFilter* filter = new BloomFilter(fresh->index->size());
+            fresh->filter = filter;
+            fresh->index->add_names(*filter);
+        } else {
+            fresh->file = new HostsFile(filename);
+            fresh->reverse = new ReverseIndex(maxaliases);
+            fresh->wildcards = new WildcardTrie(maxialiases);
+            fresh->filter = scan_names(*fresh->file, *fresh->reverse, *fresh->wildcards);
+        }
+        if (fresh->wildcards->size() == 0) {
+            delete fresh->wildcards;
+            fresh->wildcards = NULL;
+        }
+    } catch (HostsFile::FileException& e) {
+        delete fresh;
+        throw ResolveException(e.what());
+    } catch (HostsImage::ImageException& e) {
+        delete fresh;
+        throw ResolveException(e.what());
+    } catch (ResolveException& e) {
+        delete fresh;
+        throw e;
+    } catch (std::bad_alloc& e) {
+        delete fresh;
+        throw ResolveException(string("Out of memory loading \'" + filename + "\'").c_str());
+    }
+    try {
+        if (withcache)
+            fresh->cache = new_cache();
+        if (fresh->file != NULL && negsize > 0)
+            fresh->negative = new NegativeCache(negsize, shards);
+    } catch (Thread::ThreadException& e) {
+        delete fresh;
+        throw ResolveException(e.what());
+    } catch (std::bad_alloc& e) {
+        delete fresh;
+        throw ResolveException("Out of memory for the cache");
+    }
+    return fresh;
+}
 
-    string buf;
-    stringstream ss(line);
+// Build a filter from everything that could be a name in the file: each
+// token on a line but the first. Comments and bad lines only make it a bit
+// bigger, and the names that scans will find are all in it, since they come
+// from this very copy of the file. The lines that scans would use also go into the
+// reverse index, and their wildcard names into the trie.
+BloomFilter* DnsResolver::scan_names(const HostsFile& file, ReverseIndex& reverse, WildcardTrie& wildcards){
+    HostsFile::Tokenizer tokenizer(file.begin(), file.end(), maxaliases);
+    HostsFile::Record record;
+    while (tokenizer.next(record))
+        for (size_t i = 0; i < record.names.size(); i++) {
+            reverse.add(record.ip, record.names[i].ptr, record.names[i].len);
+            if (WildcardTrie::is_wildcard(record.names[i].ptr, record.names[i].len))
+                wildcards.add(record.names[i].ptr, record.names[i].len, record.ip);
+        }
 
-    if (ss >> buf){
-        int retval = inet_pton(AF_INET, buf.c_str(), reinterpret_cast<char *>(&parsed.ip));
-        switch (retval){
-        case 0:
-            return -1;
-        case -1:
-            throw ResolveException(errno, TRACELINE("could not inet_pton()"));
-        default:
-            break;
+    vector<uint32_t> hashes;
+    const char* p = file.begin();
+    while (p < file.end()) {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', file.end() - p));
+        if (eol == NULL) eol = file.end();
+        bool first = true;
+        while (p < eol) {
+            p = HostsFile::skip_blanks(p, eol);
+            const char* token = p;
+            p = HostsFile::skip_token(p, eol);
+            if (p > token && !first)
+                hashes.push_back(hash_helper(token, p - token));
+            first = false;
+        }
+        p = eol + 1;
+    }
+
+    BloomFilter* filter = new BloomFilter(hashes.size());
+    for (size_t i = 0; i < hashes.size(); i++)
+        filter->add(hashes[i]);
+    return filter;
+}
+
+DnsResolver::Cache* DnsResolver::new_cache() throw (Thread::ThreadException, std::bad_alloc){
+    switch (policy) {
+    case CACHE_CLOCK:
+        return new ClockCache(maxsize, maxialiases, rcu);
+    case CACHE_LRU:
+    case CACHE_TINYLFU:
+    case CACHE_ARC:
+    default:
+        return new ShardedCache(policy, maxsize, maxialiases, shards);
+    }
+}
+
+DnsResolver::CachePolicy DnsResolver::parse_cache_policy(const std::string& name) throw (ResolveException){
+    for (int i = 0; i < CACHE_POLICIES; i++)
+        if (name == CACHE_POLICY_NAMES[i])
+            return static_cast<CachePolicy>(i);
+    throw ResolveException(string("Unknown cache policy \'" + name + "\'").c_str());
+}
+
+// Runs in the reloader thread: publish a new snapshot, then wait until no
+// reader can still be using the old one before deleting it.
+//
+// The cache survives a reload when only a few lines changed, as is usual
+// with edits by hand or by configuration management, minus the names on
+// those lines. Indexes and filters are rebuilt all the same. That is
+// decided before any new cache is made, so a reload never holds two.
+void DnsResolver::reload(){
+    Snapshot* fresh;
+    try {
+        fresh = load_snapshot(false);
+    } catch (ResolveException& e) {
+        cerror << "Could not reload \'" << filename << "\', keeping old data: " << e.what() << endl;
+        return;
+    }
+
+    Snapshot* old = current;
+    vector<pair<string, uint32_t> > changed;
+    bool warm = false;
+    try {
+        warm = old->hosts() != NULL && fresh->hosts() != NULL &&
+            changed_names(*old->hosts(), *fresh->hosts(), changed);
+        if (warm) {
+            fresh->cache = old->cache;
+            for (size_t i = 0; i < changed.size(); i++)
+                fresh->cache->erase(changed[i].first, changed[i].second);
+            ctrace << "\t(Keeping cache, " << changed.size() << " names changed in \'" << filename << "\')" << endl;
+        } else
+            fresh->cache = new_cache();
+    } catch (Thread::ThreadException& e) {
+        cerror << "Could not update cache, keeping old data: " << e.what() << endl;
+        if (warm)
+            fresh->cache = NULL;
+        delete fresh;
+        return;
+    } catch (std::bad_alloc& e) {
+        cerror << "Out of memory reloading \'" << filename << "\', keeping old data" << endl;
+        if (warm)
+            fresh->cache = NULL;
+        delete fresh;
+        return;
+    }
+
+    // readers see everything above before they see the new snapshot
+    __sync_synchronize();
+    current = fresh;
+    ctrace << "\t(Published new snapshot of \'" << filename << "\')" << endl;
+
+    try {
+        rcu.synchronize();
+        // scans of the old snapshot may have cached the old addresses of
+        // changed names meanwhile
+        if (warm) {
+            for (size_t i = 0; i < changed.size(); i++)
+                fresh->cache->erase(changed[i].first, changed[i].second);
+            old->cache = NULL;
         }
-    }  else return -1;
+        delete old;
+    } catch (Thread::ThreadException& e) {
+        cerror << "Could not wait for readers of old snapshot, leaking it: " << e.what() << endl;
+    }
+}
 
-    while ((ss >> buf) and (parsed.aliases.size() < maxaliases))
-        parsed.aliases.push_back(buf);
+// a line of a hosts file, lines are told apart by their hashes only
+struct HostsLine {
+    uint64_t hash;
+    const char* begin;
+    const char* end;
+    bool operator<(const HostsLine& other) const { return hash < other.hash; }
+};
 
-    return parsed.aliases.size();
+static void hash_lines(const HostsFile& file, vector<HostsLine>& lines){
+    const char* p = file.begin();
+    while (p < file.end()) {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', file.end() - p));
+        if (eol == NULL) eol = file.end();
+        HostsLine line;
+        line.hash = hash64_helper(p, eol - p);
+        line.begin = p;
+        line.end = eol;
+        lines.push_back(line);
+        p = eol + 1;
+    }
+    sort(lines.begin(), lines.end());
 }
 
+// the names on lines that only one of before and after has, as the cache
+// stores them. False if there are more than the cache can hold, which might
+// as well start empty then.
+bool DnsResolver::changed_names(const HostsFile& before, const HostsFile& after,
+                                vector<pair<string, uint32_t> >& names) const {
+    vector<HostsLine> old, fresh;
+    hash_lines(before, old);
+    hash_lines(after, fresh);
+
+    vector<const HostsLine*> changed;
+    size_t i = 0, j = 0;
+    while (i < old.size() || j < fresh.size()) {
+        if (j == fresh.size() || (i < old.size() && old[i].hash < fresh[j].hash))
+            changed.push_back(&old[i++]);
+        else if (i == old.size() || fresh[j].hash < old[i].hash)
+            changed.push_back(&fresh[j++]);
+        else {
+            i++;
+            j++;
+        }
+        if (changed.size() > maxsize)
+            return false;
+    }
+
+    HostsFile::Record record;
+    for (size_t c = 0; c < changed.size(); c++) {
+        HostsFile::Tokenizer tokenizer(changed[c]->begin, changed[c]->end, maxaliases);
+        while (tokenizer.next(record))
+            for (size_t n = 0; n < record.names.size(); n++) {
+                string name(record.names[n].ptr, record.names[n].len);
+                uint32_t hash = (uint32_t) lowercase_helper(&name[0], name.data(), name.size());
+                names.push_back(make_pair(name, hash));
+            }
+        if (names.size() > maxsize)
+            return false;
+    }
+    return true;
+}
+
+unsigned long DnsResolver::cache_hits() const { return hits.value(); }
+
+unsigned long DnsResolver::cache_misses() const { return misses.value(); }
+
+unsigned long DnsResolver::negative_hits() const { return neghits.value(); }
+
+unsigned long DnsResolver::filtered() const { return filterhits.value(); }
+
+unsigned long DnsResolver::wildcard_hits() const { return wildhits.value(); }
+
+// safe to call any time, it doesn't look at the current snapshot
 std::ostream& operator<<(std::ostream& os, const DnsResolver& dns){
+    unsigned long hits = dns.cache_hits();
+    unsigned long lookups = hits + dns.cache_misses();
     return os <<
         "[DnsResolver: " <<
-        "msize=\'" << dns.cache->local_map.size() << "\' " <<
-        "lsize=\'" << dns.cache->local_list.size() << "\' " <<
-        "head=\'" << dns.cache->print_head()  << "\' " <<
-        "tail=\'" << dns.cache->print_tail()  << "\' " <<
+        "policy=\'" << DnsResolver::CACHE_POLICY_NAMES[dns.policy] << "\' " <<
+        "hits=\'" << hits << "\' " <<
+        "misses=\'" << lookups - hits << "\' " <<
+        "hitrate=\'" << (lookups ? 100.0 * hits / lookups : 0.0) << "%\' " <<
+        "negative_hits=\'" << dns.negative_hits() << "\' " <<
+        "filtered=\'" << dns.filtered() << "\' " <<
+        "wildcard_hits=\'" << dns.wildcard_hits() << "\' " <<
         "]";
 }
 
+// Snapshot nested struct
+
+DnsResolver::Snapshot::Snapshot()
+    : cache(NULL), image(NULL), index(NULL), file(NULL), negative(NULL), reverse(NULL), wildcards(NULL), filter(NULL) {}
+
+const HostsFile* DnsResolver::Snapshot::hosts() const {
+    return (index != NULL) ? &index->hosts() : file;
+}
+
+DnsResolver::Snapshot::~Snapshot(){
+    delete file;
+    delete index;
+    delete negative;
+    delete reverse;
+    delete wildcards;
+    if (image == NULL)
+        delete filter;
+    delete image;
+    delete cache;
+}
+
+// Reloader nested class
+
+DnsResolver::Reloader::Reloader(DnsResolver& r)
+    : resolver(r), stop_flag(false) {}
+
+void* DnsResolver::Reloader::main(){
+    while (true) {
+        try {
+            requests.wait();
+        } catch (Thread::ThreadException& e) {
+            cerror << "Reloader could not wait for requests: " << e.what() << endl;
+            return NULL;
+        }
+        if (stop_flag)
+            return NULL;
+        // changes from now on need another reload, this one may miss them
+        if (__sync_bool_compare_and_swap(&resolver.reload_pending, 1, 0))
+            resolver.reload();
+        if (__sync_bool_compare_and_swap(&resolver.collect_pending, 1, 0)) {
+            try {
+                resolver.rcu.collect();
+            } catch (Thread::ThreadException& e) {
+                cerror << "Could not collect retired cache entries: " << e.what() << endl;
+            }
+        }
+    }
+}
+
+// called from the watcher thread. Changes piling up while a reload is pending
+// are folded into that reload
+void DnsResolver::Reloader::file_changed(){
+    if (!__sync_bool_compare_and_swap(&resolver.reload_pending, 0, 1))
+        return;
+    cwarning << "\'" << resolver.filename << "\' has changed, reloading" << endl;
+    try {
+        requests.post();
+    } catch (Thread::ThreadException& e) {
+        cerror << "Could not request reload: " << e.what() << endl;
+        resolver.reload_pending = 0;
+    }
+}
+
+// called from any worker once enough cache entries were retired
+void DnsResolver::Reloader::collect(){
+    if (!__sync_bool_compare_and_swap(&resolver.collect_pending, 0, 1))
+        return;
+    try {
+        requests.post();
+    } catch (Thread::ThreadException& e) {
+        cerror << "Could not request collection: " << e.what() << endl;
+        resolver.collect_pending = 0;
+    }
+}
+
+void DnsResolver::Reloader::stop(){
+    stop_flag = true;
+    try {
+        requests.post();
+    } catch (Thread::ThreadException& e) {
+        cerror << "Could not stop reloader: " << e.what() << endl;
+    }
+}
 
 // Cache nested class
 
-// MapValue constructor
-DnsResolver::Cache::MapValue::MapValue(struct in_addr ip, list<map_t::iterator>::iterator li)
-    : listiter(li) {
-    ips.insert(ip);
+DnsResolver::Cache::~Cache(){}
+
+// ShardedCache nested class
+
+// split maxsize evenly, no shard is ever smaller than one entry
+DnsResolver::ShardedCache::ShardedCache(CachePolicy p, unsigned int maxsize, unsigned int maxialiases, unsigned int n)
+    : cachepolicy(p) {
+    if (n > maxsize) n = maxsize;
+    if (n == 0) n = 1;
+    unsigned int shardsize = (maxsize + n - 1) / n;
+    for (unsigned int i = 0; i < n; i++) {
+        switch (cachepolicy) {
+        case CACHE_TINYLFU:
+            shards.push_back(new TinyLfuShard(shardsize, maxialiases));
+            break;
+        case CACHE_ARC:
+            shards.push_back(new ArcShard(shardsize, maxialiases));
+            break;
+        case CACHE_LRU:
+        default:
+            shards.push_back(new LruShard(shardsize, maxialiases));
+            break;
+        }
+    }
+}
+
+DnsResolver::ShardedCache::~ShardedCache(){
+    for (size_t i = 0; i < shards.size(); i++)
+        delete shards[i];
+}
+
+DnsResolver::ShardedCache::ShardedCache(const ShardedCache& src){} // private copy constructor does nothing
+
+bool DnsResolver::ShardedCache::lookup(const string& name, uint32_t hash, addr_set_t& result) throw (Thread::ThreadException){
+    Shard& shard = *shards[hash % shards.size()];
+    shard.mutex.lock();
+    uint32_t e = shard.lookup(name, hash);
+    if (e != Store::NONE)
+        shard.store.addresses(e, result);
+    shard.mutex.unlock();
+    return e != Store::NONE;
+}
+
+bool DnsResolver::ShardedCache::lookup(const string& name, uint32_t hash, char* answers, size_t buflen, size_t& count) throw (Thread::ThreadException){
+    Shard& shard = *shards[hash % shards.size()];
+    shard.mutex.lock();
+    uint32_t e = shard.lookup(name, hash);
+    if (e != Store::NONE)
+        count = shard.store.answers(e, answers, buflen);
+    shard.mutex.unlock();
+    return e != Store::NONE;
 }
 
-DnsResolver::Cache::Cache(unsigned int ms, unsigned int maxialiases, time_t _file_mtime) :
-    maxsize(ms),
+// insert into name's shard. Unless evict is set, only do so if that needs no
+// other entry to be evicted. Names no query can ask for are never inserted,
+// entries have no room for their length
+void DnsResolver::ShardedCache::insert(const string& name, uint32_t hash, struct in_addr ip, bool evict) throw (Thread::ThreadException){
+    if (name.size() > MAX_NAME)
+        return;
+    Shard& shard = *shards[hash % shards.size()];
+    shard.mutex.lock();
+    shard.insert(name, hash, ip, evict);
+    shard.mutex.unlock();
+}
+
+bool DnsResolver::ShardedCache::has_room(uint32_t hash) const { return !shards[hash % shards.size()]->full(); }
+
+const char* DnsResolver::ShardedCache::policy() const { return CACHE_POLICY_NAMES[cachepolicy]; }
+
+void DnsResolver::ShardedCache::erase(const string& name, uint32_t hash) throw (Thread::ThreadException){
+    Shard& shard = *shards[hash % shards.size()];
+    shard.mutex.lock();
+    shard.erase(name, hash);
+    shard.mutex.unlock();
+}
+
+void DnsResolver::ShardedCache::names(vector<string>& result) const throw (Thread::ThreadException){
+    for (size_t i = 0; i < shards.size(); i++) {
+        shards[i]->mutex.lock();
+        shards[i]->names(result);
+        shards[i]->mutex.unlock();
+    }
+}
+
+// only approximate while other threads use the cache
+size_t DnsResolver::ShardedCache::size() const {
+    size_t total = 0;
+    for (size_t i = 0; i < shards.size(); i++)
+        total += shards[i]->size();
+    return total;
+}
+
+// Store nested class
+
+// the table is kept at most half full
+DnsResolver::Store::Store(unsigned int c, unsigned int maxialiases) :
+    capacity(c),
     maxipaliases(maxialiases),
-    file_mtime(_file_mtime){}
-
-DnsResolver::Cache::~Cache(){
-    local_map.clear();
-    local_list.clear();
-}
-
-const addr_set_t * DnsResolver::Cache::lookup(const string& name){
-    // lookup the key in the map
-    map_t::iterator i = local_map.find(name);
-    if (i != local_map.end() ){
-        // remove the iterator from the list pointing to the recently found
-        // element. Do this with listiter!
-        MapValue *tempvalue = &(i->second);
-        local_list.erase(tempvalue->listiter);
-        // add it again at the front of the list
-        local_list.push_front(i);
-        // update the listiter pointer in the MapValue element
-        tempvalue->listiter = local_list.begin();
-        return &((i->second).ips);
+    free_list(NONE), used(0) {
+    size_t nslots = 2;
+    while (nslots < 2 * (size_t) capacity)
+        nslots *= 2;
+    slots.assign(nslots, 0);
+    entries.resize(capacity);
+    records.resize((size_t) capacity * maxipaliases * ANSWER_RECORD_SIZE);
+    for (uint32_t e = capacity; e > 0; e--) {
+        entries[e - 1].next = free_list;
+        free_list = e - 1;
+    }
+    for (unsigned int q = 0; q < QUEUES; q++) {
+        queues[q].head = queues[q].tail = NONE;
+        queues[q].size = 0;
+    }
+}
+
+// the entry, its answer records, and two to four table slots
+size_t DnsResolver::Store::entry_size(unsigned int maxialiases){
+    return sizeof(Entry) + (size_t) maxialiases * ANSWER_RECORD_SIZE + 4 * sizeof(uint32_t);
+}
+
+uint32_t DnsResolver::Store::find(const string& name, uint32_t hash) const {
+    size_t mask = slots.size() - 1;
+    for (size_t pos = hash & mask; slots[pos] != 0; pos = (pos + 1) & mask) {
+        const Entry& entry = entries[slots[pos] - 1];
+        if (entry.hash != hash || entry.len != name.size())
+            continue;
+        if (entry.len <= NAME_INLINE) {
+            if (memcmp(entry.name, name.data(), entry.len) == 0)
+                return slots[pos] - 1;
+        } else if (memcmp(entry.name, name.data(), NAME_INLINE) == 0 &&
+                   tails.find(slots[pos] - 1)->second.compare(0, string::npos, name, NAME_INLINE, string::npos) == 0)
+            return slots[pos] - 1;
+    }
+    return NONE;
+}
+
+size_t DnsResolver::Store::slot_of(uint32_t e) const {
+    size_t mask = slots.size() - 1;
+    size_t pos = entries[e].hash & mask;
+    while (slots[pos] != e + 1)
+        pos = (pos + 1) & mask;
+    return pos;
+}
+
+uint32_t DnsResolver::Store::add(const string& name, uint32_t hash, unsigned int queue){
+    uint32_t e = free_list;
+    Entry& entry = entries[e];
+    if (name.size() > NAME_INLINE)
+        tails[e] = name.substr(NAME_INLINE);
+    free_list = entry.next;
+    used++;
+
+    entry.hash = hash;
+    entry.len = name.size();
+    memcpy(entry.name, name.data(), (name.size() < NAME_INLINE) ? name.size() : NAME_INLINE);
+    entry.naddrs = 0;
+    push_front(e, queue);
+
+    size_t mask = slots.size() - 1;
+    size_t pos;
+    for (pos = hash & mask; slots[pos] != 0; pos = (pos + 1) & mask);
+    slots[pos] = e + 1;
+    return e;
+}
+
+// backward shift deletion, so that no tombstones are needed
+void DnsResolver::Store::remove(uint32_t e){
+    size_t mask = slots.size() - 1;
+    size_t pos = slot_of(e);
+    slots[pos] = 0;
+    for (size_t next = (pos + 1) & mask; slots[next] != 0; next = (next + 1) & mask) {
+        size_t home = entries[slots[next] - 1].hash & mask;
+        // move next back into the hole unless its home lies cyclically in (pos, next]
+        bool stays = (pos <= next) ? (pos < home && home <= next) : (pos < home || home <= next);
+        if (!stays) {
+            slots[pos] = slots[next];
+            slots[next] = 0;
+            pos = next;
+        }
+    }
+    unlink(e);
+    if (entries[e].len > NAME_INLINE)
+        tails.erase(e);
+    entries[e].next = free_list;
+    free_list = e;
+    used--;
+}
+
+void DnsResolver::Store::unlink(uint32_t e){
+    Entry& entry = entries[e];
+    Queue& q = queues[entry.queue];
+    if (entry.prev != NONE) entries[entry.prev].next = entry.next; else q.head = entry.next;
+    if (entry.next != NONE) entries[entry.next].prev = entry.prev; else q.tail = entry.prev;
+    q.size--;
+}
+
+void DnsResolver::Store::push_front(uint32_t e, unsigned int queue){
+    Entry& entry = entries[e];
+    Queue& q = queues[queue];
+    entry.queue = queue;
+    entry.prev = NONE;
+    entry.next = q.head;
+    if (q.head != NONE) entries[q.head].prev = e; else q.tail = e;
+    q.head = e;
+    q.size++;
+}
+
+void DnsResolver::Store::move(uint32_t e, unsigned int queue){
+    if (entries[e].queue == queue && queues[queue].head == e)
+        return;
+    unlink(e);
+    push_front(e, queue);
+}
+
+unsigned int DnsResolver::Store::queue_of(uint32_t e) const { return entries[e].queue; }
+
+uint32_t DnsResolver::Store::hash(uint32_t e) const { return entries[e].hash; }
+
+uint32_t DnsResolver::Store::back(unsigned int queue) const { return queues[queue].tail; }
+
+void DnsResolver::Store::names(unsigned int queue, vector<string>& result) const {
+    for (uint32_t e = queues[queue].head; e != NONE; e = entries[e].next) {
+        result.push_back(string(entries[e].name, (entries[e].len < NAME_INLINE) ? entries[e].len : NAME_INLINE));
+        if (entries[e].len > NAME_INLINE)
+            result.back() += tails.find(e)->second;
+    }
+}
+
+uint32_t DnsResolver::Store::queue_size(unsigned int queue) const { return queues[queue].size; }
+
+uint32_t DnsResolver::Store::count() const { return used; }
+
+bool DnsResolver::Store::full() const { return used == capacity; }
+
+// unless it's already there or there's no room left
+void DnsResolver::Store::add_address(uint32_t e, struct in_addr ip){
+    Entry& entry = entries[e];
+    char* record = &records[(size_t) e * maxipaliases * ANSWER_RECORD_SIZE];
+    for (unsigned int i = 0; i < entry.naddrs; i++, record += ANSWER_RECORD_SIZE)
+        if (answer_address(record).s_addr == ip.s_addr)
+            return;
+    if (entry.naddrs < maxipaliases) {
+        answer_record(record, ip);
+        entry.naddrs++;
+    }
+}
+
+void DnsResolver::Store::clear_addresses(uint32_t e){ entries[e].naddrs = 0; }
+
+void DnsResolver::Store::addresses(uint32_t e, addr_set_t& result) const {
+    const char* record = &records[(size_t) e * maxipaliases * ANSWER_RECORD_SIZE];
+    for (unsigned int i = 0; i < entries[e].naddrs; i++, record += ANSWER_RECORD_SIZE)
+        result.insert(answer_address(record));
+}
+
+size_t DnsResolver::Store::answers(uint32_t e, char* buff, size_t buflen) const {
+    size_t count = entries[e].naddrs;
+    size_t fit = buflen / ANSWER_RECORD_SIZE;
+    memcpy(buff, &records[(size_t) e * maxipaliases * ANSWER_RECORD_SIZE],
+           ((count < fit) ? count : fit) * ANSWER_RECORD_SIZE);
+    return count;
+}
+
+std::ostream& DnsResolver::Store::print_name(std::ostream& os, uint32_t e) const {
+    if (entries[e].len <= NAME_INLINE)
+        return os.write(entries[e].name, entries[e].len);
+    return os.write(entries[e].name, NAME_INLINE) << tails.find(e)->second;
+}
+
+// Shard nested nested class
+
+DnsResolver::ShardedCache::Shard::Shard(unsigned int capacity, unsigned int maxialiases)
+    : store(capacity, maxialiases) {}
+
+DnsResolver::ShardedCache::Shard::~Shard(){}
+
+// LruShard nested nested class
+
+DnsResolver::ShardedCache::LruShard::LruShard(unsigned int maxsize, unsigned int maxialiases)
+    : Shard(maxsize, maxialiases) {}
+
+uint32_t DnsResolver::ShardedCache::LruShard::lookup(const string& name, uint32_t hash){
+    uint32_t e = store.find(name, hash);
+    // move the entry found up to the beginning of the list
+    if (e != Store::NONE)
+        store.move(e, 0);
+    return e;
+}
+
+void DnsResolver::ShardedCache::LruShard::insert(const string& name, uint32_t hash, struct in_addr ip, bool evict){
+    uint32_t e = store.find(name, hash);
+    if (e == Store::NONE) {
+        if (store.full()) {
+            if (!evict) {
+                cwarning << "\t(Cache is full \'" << name << "\' not inserted)" << endl;
+                return;
+            }
+            // make room by removing the least important element, the back of the list
+            uint32_t victim = store.back(0);
+            store.print_name(cwarning << "\t(removing \'", victim) << "\' from cache)" << endl;
+            store.remove(victim);
+        }
+        e = store.add(name, hash, 0);
+    }
+    store.add_address(e, ip);
+}
+
+size_t DnsResolver::ShardedCache::LruShard::size() const { return store.count(); }
+
+bool DnsResolver::ShardedCache::LruShard::full() const { return store.full(); }
+
+void DnsResolver::ShardedCache::LruShard::erase(const string& name, uint32_t hash){
+    uint32_t e = store.find(name, hash);
+    if (e != Store::NONE)
+        store.remove(e);
+}
+
+void DnsResolver::ShardedCache::LruShard::names(vector<string>& result) const { store.names(0, result); }
+
+// Sketch nested nested class
+
+static const uint32_t SKETCH_SEEDS[4] = {0x9E3779B1, 0x85EBCA77, 0xC2B2AE3D, 0x27D4EB2F};
+
+// four times as many counters per row as entries, so that the names that
+// are not cached don't blur the counts too much, halved after ten times as
+// many additions
+DnsResolver::ShardedCache::Sketch::Sketch(unsigned int maxsize)
+    : additions(0) {
+    size_t width = 64;
+    while (width < 4 * (size_t) maxsize)
+        width *= 2;
+    counters.assign(ROWS * width, 0);
+    mask = width - 1;
+    sample = 10 * width;
+}
+
+size_t DnsResolver::ShardedCache::Sketch::index(uint32_t hash, unsigned int row) const {
+    uint32_t h = (hash ^ (hash >> 15)) * SKETCH_SEEDS[row];
+    h ^= h >> 13;
+    return row * (mask + 1) + (h & mask);
+}
+
+void DnsResolver::ShardedCache::Sketch::increment(uint32_t hash){
+    for (unsigned int row = 0; row < ROWS; row++) {
+        unsigned char& counter = counters[index(hash, row)];
+        if (counter < MAXCOUNT)
+            counter++;
+    }
+    if (++additions >= sample) {
+        for (size_t i = 0; i < counters.size(); i++)
+            counters[i] >>= 1;
+        additions /= 2;
     }
-    return NULL;
 }
 
-const addr_set_t* DnsResolver::Cache::insert(string& alias, struct in_addr ip){
+unsigned int DnsResolver::ShardedCache::Sketch::frequency(uint32_t hash) const {
+    unsigned int min = MAXCOUNT;
+    for (unsigned int row = 0; row < ROWS; row++)
+        if (counters[index(hash, row)] < min)
+            min = counters[index(hash, row)];
+    return min;
+}
 
-    // add element to map and keep an iterator to it. point the newly
-    // MapValue to local_list.begin(), but that will be made invalid soon.
+// TinyLfuShard nested nested class
 
-    map_t::iterator retval_iter;
-    if ((retval_iter = local_map.find(alias)) != local_map.end()){
-        if (retval_iter->second.ips.size() < maxipaliases)
-            retval_iter->second.ips.insert(ip);
+// a window of 1% of the entries, 80% of the rest are protected, the others
+// on probation
+DnsResolver::ShardedCache::TinyLfuShard::TinyLfuShard(unsigned int ms, unsigned int maxialiases)
+    : Shard(ms + 1, maxialiases), sketch(ms), maxsize(ms) {
+    maxwindow = maxsize / 100;
+    if (maxwindow == 0) maxwindow = 1;
+    maxprotected = (maxsize - maxwindow) * 4 / 5;
+}
+
+uint32_t DnsResolver::ShardedCache::TinyLfuShard::lookup(const string& name, uint32_t hash){
+    // every access counts, hit or miss
+    sketch.increment(hash);
+    uint32_t e = store.find(name, hash);
+    if (e == Store::NONE)
+        return e;
+    if (store.queue_of(e) == WINDOW) {
+        store.move(e, WINDOW);
     } else {
-        MapValue value(ip, local_list.begin());
-        pair<map_t::iterator,bool> temppair =
-            local_map.insert(make_pair(alias, value));
-        if (temppair.second != true){
-            cerror << "DnsResolver::Cache::insert(): Insertion of " << alias << " failed!" << endl;
-            return NULL;
+        // promote to protected, demoting its oldest entry if it overflows
+        store.move(e, PROTECTED);
+        if (store.queue_size(PROTECTED) > maxprotected)
+            store.move(store.back(PROTECTED), PROBATION);
+    }
+    return e;
+}
+
+void DnsResolver::ShardedCache::TinyLfuShard::insert(const string& name, uint32_t hash, struct in_addr ip, bool evict){
+    uint32_t e = store.find(name, hash);
+    if (e != Store::NONE) {
+        store.add_address(e, ip);
+        return;
+    }
+    if (!evict && store.count() >= maxsize) {
+        cwarning << "\t(Cache is full \'" << name << "\' not inserted)" << endl;
+        return;
+    }
+    e = store.add(name, hash, WINDOW);
+    store.add_address(e, ip);
+    if (store.queue_size(WINDOW) > maxwindow)
+        admit(store.back(WINDOW));
+}
+
+// candidate leaves the window: it enters the main cache if that has room,
+// else if it is more popular than the entry that would be evicted for it
+void DnsResolver::ShardedCache::TinyLfuShard::admit(uint32_t candidate){
+    unsigned int mainsize = store.queue_size(PROBATION) + store.queue_size(PROTECTED);
+    if (mainsize < maxsize - maxwindow) {
+        store.move(candidate, PROBATION);
+        return;
+    }
+    uint32_t victim = store.queue_size(PROBATION) ? store.back(PROBATION) : store.back(PROTECTED);
+    if (victim != Store::NONE && sketch.frequency(store.hash(candidate)) > sketch.frequency(store.hash(victim))) {
+        store.move(candidate, PROBATION);
+    } else {
+        victim = candidate;
+    }
+    store.print_name(cwarning << "\t(removing \'", victim) << "\' from cache)" << endl;
+    store.remove(victim);
+}
+
+size_t DnsResolver::ShardedCache::TinyLfuShard::size() const { return store.count(); }
+
+bool DnsResolver::ShardedCache::TinyLfuShard::full() const { return store.count() >= maxsize; }
+
+void DnsResolver::ShardedCache::TinyLfuShard::erase(const string& name, uint32_t hash){
+    uint32_t e = store.find(name, hash);
+    if (e != Store::NONE)
+        store.remove(e);
+}
+
+void DnsResolver::ShardedCache::TinyLfuShard::names(vector<string>& result) const {
+    store.names(PROTECTED, result);
+    store.names(PROBATION, result);
+    store.names(WINDOW, result);
+}
+
+// ArcShard nested nested class
+
+// room for maxsize entries and as many ghosts
+DnsResolver::ShardedCache::ArcShard::ArcShard(unsigned int ms, unsigned int maxialiases)
+    : Shard(2 * ms, maxialiases), maxsize(ms), target(0) {}
+
+uint32_t DnsResolver::ShardedCache::ArcShard::lookup(const string& name, uint32_t hash){
+    uint32_t e = store.find(name, hash);
+    if (e == Store::NONE || store.queue_of(e) == B1 || store.queue_of(e) == B2)
+        return Store::NONE;
+    // seen at least twice now
+    store.move(e, T2);
+    return e;
+}
+
+void DnsResolver::ShardedCache::ArcShard::insert(const string& name, uint32_t hash, struct in_addr ip, bool evict){
+    uint32_t e = store.find(name, hash);
+    unsigned int queue = (e == Store::NONE) ? B1 : store.queue_of(e);
+    if (e != Store::NONE && (queue == T1 || queue == T2)) {
+        store.add_address(e, ip);
+        return;
+    }
+    unsigned int resident = size();
+    if (!evict && resident >= maxsize) {
+        cwarning << "\t(Cache is full \'" << name << "\' not inserted)" << endl;
+        return;
+    }
+
+    if (e != Store::NONE) {
+        // a ghost hit: T1 should have been bigger if it's in B1, T2 if in B2
+        unsigned int b1 = store.queue_size(B1), b2 = store.queue_size(B2);
+        if (queue == B1) {
+            unsigned int delta = (b2 > b1) ? b2 / b1 : 1;
+            target = (target + delta > maxsize) ? maxsize : target + delta;
+        } else {
+            unsigned int delta = (b1 > b2) ? b1 / b2 : 1;
+            target = (target > delta) ? target - delta : 0;
+        }
+        if (resident >= maxsize)
+            replace(queue == B2);
+        store.clear_addresses(e);
+        store.move(e, T2);
+    } else {
+        unsigned int l1 = store.queue_size(T1) + store.queue_size(B1);
+        if (l1 >= maxsize) {
+            if (store.queue_size(T1) < maxsize) {
+                store.remove(store.back(B1));
+                if (resident >= maxsize)
+                    replace(false);
+            } else {
+                uint32_t victim = store.back(T1);
+                store.print_name(cwarning << "\t(removing \'", victim) << "\' from cache)" << endl;
+                store.remove(victim);
+            }
+        } else if (resident >= maxsize) {
+            if (store.count() >= 2 * maxsize)
+                store.remove(store.back(B2));
+            replace(false);
+        }
+        // the lists never hold more than 2 * maxsize, but don't count on it
+        while (store.full())
+            store.remove(store.queue_size(B2) ? store.back(B2) : store.back(B1));
+        e = store.add(name, hash, T1);
+    }
+    store.add_address(e, ip);
+}
+
+// evict the back of T1 or T2 into its ghost list, depending on target
+void DnsResolver::ShardedCache::ArcShard::replace(bool inb2){
+    unsigned int t1 = store.queue_size(T1);
+    bool fromt1 = t1 > 0 && (t1 > target || (inb2 && t1 == target));
+    if (store.queue_size(T2) == 0)
+        fromt1 = true;
+    uint32_t victim = store.back(fromt1 ? T1 : T2);
+    store.print_name(cwarning << "\t(removing \'", victim) << "\' from cache)" << endl;
+    store.clear_addresses(victim);
+    store.move(victim, fromt1 ? B1 : B2);
+}
+
+size_t DnsResolver::ShardedCache::ArcShard::size() const { return store.queue_size(T1) + store.queue_size(T2); }
+
+bool DnsResolver::ShardedCache::ArcShard::full() const { return size() >= maxsize; }
+
+// ghosts have no addresses, so they can stay
+void DnsResolver::ShardedCache::ArcShard::erase(const string& name, uint32_t hash){
+    uint32_t e = store.find(name, hash);
+    if (e != Store::NONE && (store.queue_of(e) == T1 || store.queue_of(e) == T2))
+        store.remove(e);
+}
+
+// names seen twice first, ghosts are left out
+void DnsResolver::ShardedCache::ArcShard::names(vector<string>& result) const {
+    store.names(T2, result);
+    store.names(T1, result);
+}
+
+// ClockCache nested class
+
+DnsResolver::ClockCache::Entry::Entry(const string& n, uint32_t h)
+    : name(n), hash(h) {}
+
+void DnsResolver::ClockCache::Entry::add_address(struct in_addr ip){
+    char record[ANSWER_RECORD_SIZE];
+    answer_record(record, ip);
+    records.append(record, ANSWER_RECORD_SIZE);
+}
+
+// enough sets of WAYS entries to hold maxsize, rounded up to a power of two
+DnsResolver::ClockCache::ClockCache(unsigned int maxsize, unsigned int maxialiases, Thread::Rcu& r)
+    : maxsize(maxsize), maxipaliases(maxialiases), rcu(r), count(0) {
+    size_t nsets = 1;
+    while (nsets * WAYS < maxsize)
+        nsets *= 2;
+    Set empty;
+    for (unsigned int w = 0; w < WAYS; w++) {
+        empty.ways[w] = NULL;
+        empty.referenced[w] = 0;
+    }
+    empty.hand = 0;
+    sets.assign(nsets, empty);
+    stripes = new Thread::Mutex[STRIPES];
+}
+
+// only called once no reader is left
+DnsResolver::ClockCache::~ClockCache(){
+    for (size_t i = 0; i < sets.size(); i++)
+        for (unsigned int w = 0; w < WAYS; w++)
+            delete sets[i].ways[w];
+    delete []stripes;
+}
+
+DnsResolver::ClockCache::ClockCache(const ClockCache& src) : rcu(src.rcu) {} // private copy constructor does nothing
+
+// wait-free: at most WAYS compares, and no writes except for setting a
+// reference bit that isn't set yet
+bool DnsResolver::ClockCache::lookup(const string& name, uint32_t hash, addr_set_t& result) throw (Thread::ThreadException){
+    Set& set = sets[hash & (sets.size() - 1)];
+    for (unsigned int w = 0; w < WAYS; w++) {
+        const Entry* entry = set.ways[w];
+        if (entry != NULL && entry->hash == hash && entry->name == name) {
+            if (!set.referenced[w])
+                set.referenced[w] = 1;
+            for (size_t i = 0; i < entry->records.size(); i += ANSWER_RECORD_SIZE)
+                result.insert(answer_address(&entry->records[i]));
+            return true;
+        }
+    }
+    return false;
+}
+
+bool DnsResolver::ClockCache::lookup(const string& name, uint32_t hash, char* answers, size_t buflen, size_t& count) throw (Thread::ThreadException){
+    Set& set = sets[hash & (sets.size() - 1)];
+    for (unsigned int w = 0; w < WAYS; w++) {
+        const Entry* entry = set.ways[w];
+        if (entry != NULL && entry->hash == hash && entry->name == name) {
+            if (!set.referenced[w])
+                set.referenced[w] = 1;
+            size_t size = entry->records.size();
+            count = size / ANSWER_RECORD_SIZE;
+            memcpy(answers, entry->records.data(), (size < buflen) ? size : buflen - buflen % ANSWER_RECORD_SIZE);
+            return true;
+        }
+    }
+    return false;
+}
+
+// entries are completely built before they become visible, the one replaced
+// is freed once no reader can see it anymore
+void DnsResolver::ClockCache::publish(Set& set, unsigned int way, Entry* entry){
+    __sync_synchronize();
+    Entry* old = __sync_lock_test_and_set(&set.ways[way], entry);
+    if (old != NULL)
+        rcu.retire(old);
+}
+
+void DnsResolver::ClockCache::insert(const string& name, uint32_t hash, struct in_addr ip, bool evict) throw (Thread::ThreadException){
+    size_t index = hash & (sets.size() - 1);
+    Set& set = sets[index];
+    Thread::Mutex& stripe = stripes[index % STRIPES];
+
+    stripe.lock();
+    unsigned int way = WAYS;
+    unsigned int free = WAYS;
+    unsigned int used = 0;
+    for (unsigned int w = 0; w < WAYS; w++) {
+        const Entry* entry = set.ways[w];
+        if (entry == NULL) {
+            free = (free == WAYS) ? w : free;
+        } else {
+            used++;
+            if (entry->hash == hash && entry->name == name)
+                way = w;
+        }
+    }
+
+    if (way != WAYS) {
+        // copy the entry with one more address
+        const Entry* entry = set.ways[way];
+        size_t naddrs = entry->records.size() / ANSWER_RECORD_SIZE;
+        bool known = false;
+        for (size_t i = 0; i < naddrs && !known; i++)
+            known = answer_address(&entry->records[i * ANSWER_RECORD_SIZE]).s_addr == ip.s_addr;
+        if (naddrs < maxipaliases && !known) {
+            Entry* fresh = new Entry(*entry);
+            fresh->add_address(ip);
+            publish(set, way, fresh);
+        }
+    } else if (free != WAYS && (count < maxsize || (evict && used == 0))) {
+        // sets are only rounded up for hashing, the cache holds maxsize names
+        __sync_fetch_and_add(&count, 1);
+        Entry* fresh = new Entry(name, hash);
+        fresh->add_address(ip);
+        set.referenced[free] = 0;
+        publish(set, free, fresh);
+    } else if (evict) {
+        // CLOCK: the hand clears reference bits until it finds an entry
+        // that hasn't been used since it last came by
+        while (set.ways[set.hand] == NULL || set.referenced[set.hand]) {
+            set.referenced[set.hand] = 0;
+            set.hand = (set.hand + 1) % WAYS;
+        }
+        unsigned int victim = set.hand;
+        set.hand = (set.hand + 1) % WAYS;
+        cwarning << "\t(removing \'" << set.ways[victim]->name << "\' from cache)" << endl;
+        Entry* fresh = new Entry(name, hash);
+        fresh->add_address(ip);
+        set.referenced[victim] = 0;
+        publish(set, victim, fresh);
+    } else {
+        cwarning << "\t(Cache is full \'" << name << "\' not inserted)" << endl;
+    }
+    stripe.unlock();
+}
+
+size_t DnsResolver::ClockCache::size() const { return count; }
+
+bool DnsResolver::ClockCache::has_room(uint32_t hash) const { return count < maxsize; }
+
+void DnsResolver::ClockCache::erase(const string& name, uint32_t hash) throw (Thread::ThreadException){
+    size_t index = hash & (sets.size() - 1);
+    Set& set = sets[index];
+    Thread::Mutex& stripe = stripes[index % STRIPES];
+
+    stripe.lock();
+    for (unsigned int w = 0; w < WAYS; w++) {
+        const Entry* entry = set.ways[w];
+        if (entry != NULL && entry->hash == hash && entry->name == name) {
+            publish(set, w, NULL);
+            __sync_fetch_and_sub(&count, 1);
+            break;
+        }
+    }
+    stripe.unlock();
+}
+
+// callers must be in an rcu read section, like those of lookup(). Names
+// used since the hand last came by go first
+void DnsResolver::ClockCache::names(vector<string>& result) const throw (Thread::ThreadException){
+    for (int referenced = 1; referenced >= 0; referenced--)
+        for (size_t i = 0; i < sets.size(); i++)
+            for (unsigned int w = 0; w < WAYS; w++) {
+                const Entry* entry = sets[i].ways[w];
+                if (entry != NULL && (sets[i].referenced[w] != 0) == (referenced != 0))
+                    result.push_back(entry->name);
+            }
+}
+
+const char* DnsResolver::ClockCache::policy() const { return CACHE_POLICY_NAMES[CACHE_CLOCK]; }
+
+// NegativeCache nested class
+
+DnsResolver::NegativeCache::NegativeCache(unsigned int maxsize, unsigned int n){
+    if (n > maxsize) n = maxsize;
+    if (n == 0) n = 1;
+    unsigned int shardsize = (maxsize + n - 1) / n;
+    for (unsigned int i = 0; i < n; i++)
+        shards.push_back(new Shard(shardsize));
+}
+
+DnsResolver::NegativeCache::~NegativeCache(){
+    for (size_t i = 0; i < shards.size(); i++)
+        delete shards[i];
+}
+
+DnsResolver::NegativeCache::NegativeCache(const NegativeCache& src){} // private copy constructor does nothing
+
+bool DnsResolver::NegativeCache::lookup(const string& name, uint32_t hash) throw (Thread::ThreadException){
+    Shard& shard = *shards[hash % shards.size()];
+    shard.mutex.lock();
+    uint32_t e = shard.store.find(name, hash);
+    if (e != Store::NONE)
+        shard.store.move(e, 0);
+    shard.mutex.unlock();
+    return e != Store::NONE;
+}
+
+void DnsResolver::NegativeCache::insert(const string& name, uint32_t hash) throw (Thread::ThreadException){
+    Shard& shard = *shards[hash % shards.size()];
+    shard.mutex.lock();
+    if (shard.store.find(name, hash) == Store::NONE) {
+        if (shard.store.full())
+            shard.store.remove(shard.store.back(0));
+        shard.store.add(name, hash, 0);
+    }
+    shard.mutex.unlock();
+}
+
+// names missing from the file have no addresses
+DnsResolver::NegativeCache::Shard::Shard(unsigned int maxsize)
+    : store(maxsize, 0) {}
+
+// Index nested class
+
+DnsResolver::Index::Index(HostsFile* f, unsigned int maxaliases, unsigned int maxialiases, ReverseIndex& reverse,
+                          WildcardTrie& wildcards, bool perfectflag, unsigned int threads)
+    : file(f) {
+
+    size_t most = file->size() / MIN_CHUNK;
+    vector<const char*> starts = file->split((most < threads) ? ((most > 0) ? most : 1) : threads);
+    unsigned int nchunks = starts.size() - 1;
+
+    vector<Chunk*> chunks;
+    for (unsigned int i = 0; i < nchunks; i++)
+        chunks.push_back(new Chunk(starts[i], starts[i + 1], maxaliases, nchunks));
+    vector<Thread::Runnable*> tasks(chunks.begin(), chunks.end());
+    run_all(tasks);
+
+    // as many parts as chunks, and one thread for the tables in file order
+    tasks.clear();
+    for (unsigned int i = 0; i < nchunks; i++) {
+        parts.push_back(new Part(i, chunks, maxialiases, perfectflag));
+        tasks.push_back(parts.back());
+    }
+    Ordered ordered(chunks, reverse, wildcards);
+    tasks.push_back(&ordered);
+    run_all(tasks);
+
+    for (unsigned int i = 0; i < nchunks; i++)
+        delete chunks[i];
+}
+
+DnsResolver::Index::~Index(){
+    for (size_t i = 0; i < parts.size(); i++)
+        delete parts[i];
+    delete file;
+}
+
+DnsResolver::Index::Index(const Index& src){} // private copy constructor does nothing
+
+// each task but the last in a thread of its own, the last one in the calling
+// thread. A task whose thread can't be started runs there too.
+void DnsResolver::Index::run_all(const vector<Thread::Runnable*>& tasks){
+    vector<Thread*> threads;
+    for (size_t i = 0; i + 1 < tasks.size(); i++) {
+        Thread* thread = new Thread(*tasks[i]);
+        try {
+            thread->run();
+            threads.push_back(thread);
+        } catch (Thread::ThreadException& e) {
+            cwarning << "Loading with fewer threads: " << e.what() << endl;
+            delete thread;
+            tasks[i]->main();
+        }
+    }
+    if (!tasks.empty())
+        tasks.back()->main();
+    for (size_t i = 0; i < threads.size(); i++) {
+        try {
+            threads[i]->join(NULL);
+        } catch (Thread::ThreadException& e) {
+            cerror << "Could not join a loading thread: " << e.what() << endl;
+        }
+        delete threads[i];
+    }
+}
+
+bool DnsResolver::Index::lookup(const string& name, uint64_t hash, addr_set_t& result) const {
+    return parts[(hash >> 32) % parts.size()]->lookup(name, hash, result);
+}
+
+void DnsResolver::Index::add_names(BloomFilter& filter) const {
+    for (size_t i = 0; i < parts.size(); i++)
+        parts[i]->add_names(filter);
+}
+
+const HostsFile& DnsResolver::Index::hosts() const { return *file; }
+
+size_t DnsResolver::Index::size() const {
+    size_t total = 0;
+    for (size_t i = 0; i < parts.size(); i++)
+        total += parts[i]->size();
+    return total;
+}
+
+// Chunk nested nested class
+
+DnsResolver::Index::Chunk::Chunk(const char* b, const char* e, unsigned int m, unsigned int nparts)
+    : parts(nparts), begin(b), end(e), maxaliases(m) {}
+
+void* DnsResolver::Index::Chunk::main(){
+    HostsFile::Tokenizer tokenizer(begin, end, maxaliases);
+    HostsFile::Record record;
+    while (tokenizer.next(record)) {
+        for (size_t i = 0; i < record.names.size(); i++) {
+            Parsed parsed;
+            parsed.name = record.names[i].ptr;
+            parsed.len = record.names[i].len;
+            parsed.ip = record.ip;
+            parsed.hash = hash64_helper(parsed.name, parsed.len);
+            parts[(parsed.hash >> 32) % parts.size()].push_back(names.size());
+            names.push_back(parsed);
         }
-        // insert into the beginning of the list the recently obtained iterator to
-        // the map
-        local_list.push_front(temppair.first);
+    }
+    return NULL;
+}
 
-        // now do the reverse: let the MapValue listiter element also point to its
-        // place in the list
-        temppair.first->second.listiter=local_list.begin();
+// Ordered nested nested class
 
-        retval_iter = temppair.first;
+DnsResolver::Index::Ordered::Ordered(const vector<Chunk*>& c, ReverseIndex& r, WildcardTrie& w)
+    : chunks(c), reverse(r), wildcards(w) {}
 
-        // if we exceeded the maximum allowed size, remove from both list and map
-        // the least important element, the back of the list
-        if (local_list.size() > maxsize){
-            // remove from map
-            cwarning << "\t(removing \'" << print_tail() << "\' from cache)" << endl;
-            local_map.erase(local_list.back());
-            local_list.pop_back();
+void* DnsResolver::Index::Ordered::main(){
+    for (size_t c = 0; c < chunks.size(); c++) {
+        const vector<Parsed>& names = chunks[c]->names;
+        for (size_t i = 0; i < names.size(); i++) {
+            reverse.add(names[i].ip, names[i].name, names[i].len);
+            if (WildcardTrie::is_wildcard(names[i].name, names[i].len))
+                wildcards.add(names[i].name, names[i].len, names[i].ip);
         }
     }
-    return &(retval_iter->second.ips);
+    return NULL;
+}
+
+// Part nested nested class
+
+DnsResolver::Index::Part::Part(unsigned int n, const vector<Chunk*>& c, unsigned int maxialiases, bool p)
+    : number(n), chunks(c), maxipaliases(maxialiases), perfectflag(p), slots(16, 0), perfect(NULL) {}
+
+DnsResolver::Index::Part::~Part(){
+    delete perfect;
+}
+
+DnsResolver::Index::Part::Part(const Part& src) : chunks(src.chunks) {} // private copy constructor does nothing
+
+void* DnsResolver::Index::Part::main(){
+    for (size_t c = 0; c < chunks.size(); c++) {
+        const vector<Parsed>& names = chunks[c]->names;
+        const vector<uint32_t>& mine = chunks[c]->parts[number];
+        for (size_t i = 0; i < mine.size(); i++)
+            insert(names[mine[i]]);
+    }
+    if (perfectflag && !entries.empty())
+        make_perfect();
+    return NULL;
+}
+
+// linear probing: return the slot holding name, or the empty slot where it
+// should go. Names in the file keep their case, so Foo and foo share a slot.
+size_t DnsResolver::Index::Part::find_slot(const char* name, size_t len, uint32_t hash) const {
+    size_t mask = slots.size() - 1;
+    size_t pos = hash & mask;
+    while (slots[pos] != 0) {
+        const Entry& entry = entries[slots[pos] - 1];
+        if (entry.hash == hash && entry.len == len && nocase_equal_helper(entry.name, name, len))
+            break;
+        pos = (pos + 1) & mask;
+    }
+    return pos;
+}
+
+bool DnsResolver::Index::Part::lookup(const string& name, uint64_t hash, addr_set_t& result) const {
+    const Entry* entry;
+    if (perfect != NULL) {
+        entry = &entries[perfect->lookup(hash)];
+        if (entry->len != name.size() || !nocase_equal_helper(entry->name, name.data(), name.size()))
+            return false;
+    } else {
+        size_t pos = find_slot(name.data(), name.size(), (uint32_t) hash);
+        if (slots[pos] == 0)
+            return false;
+        entry = &entries[slots[pos] - 1];
+    }
+    for (uint32_t i = entry->addr; i != NONE; i = addrs[i].next)
+        result.insert(addrs[i].ip);
+    return true;
+}
+
+void DnsResolver::Index::Part::add_names(BloomFilter& filter) const {
+    for (size_t i = 0; i < entries.size(); i++)
+        filter.add(entries[i].hash);
+}
+
+void DnsResolver::Index::Part::insert(const Parsed& name){
+    uint32_t hash = (uint32_t) name.hash;
+    size_t pos = find_slot(name.name, name.len, hash);
+    if (slots[pos] == 0) {
+        Entry entry;
+        entry.hash = hash;
+        entry.len = name.len;
+        entry.name = name.name;
+        entry.addr = NONE;
+        entry.naddrs = 0;
+        entries.push_back(entry);
+        slots[pos] = entries.size();
+    }
+
+    // prepend ip to the name's address chain, unless it's already there
+    Entry& entry = entries[slots[pos] - 1];
+    if (entry.naddrs >= maxipaliases)
+        return;
+    for (uint32_t i = entry.addr; i != NONE; i = addrs[i].next)
+        if (addrs[i].ip.s_addr == name.ip.s_addr)
+            return;
+    Addr addr;
+    addr.ip = name.ip;
+    addr.next = entry.addr;
+    addrs.push_back(addr);
+    entry.addr = addrs.size() - 1;
+    entry.naddrs++;
+
+    // keep the load factor under one half so that probe sequences stay short
+    if (entries.size() * 2 > slots.size())
+        grow();
+}
+
+// double the slot table and rehash, entries themselves don't move
+void DnsResolver::Index::Part::grow(){
+    vector<uint32_t> old;
+    old.swap(slots);
+    slots.assign(old.size() * 2, 0);
+    size_t mask = slots.size() - 1;
+    for (size_t i = 0; i < old.size(); i++) {
+        if (old[i] == 0) continue;
+        size_t pos = entries[old[i] - 1].hash & mask;
+        while (slots[pos] != 0)
+            pos = (pos + 1) & mask;
+        slots[pos] = old[i];
+    }
+}
+
+// put each entry where the perfect hash of its name says, and drop the slots.
+// Only the index's memory is at stake if that fails, so it keeps its slots.
+void DnsResolver::Index::Part::make_perfect(){
+    vector<uint64_t> keys(entries.size());
+    for (size_t i = 0; i < entries.size(); i++)
+        keys[i] = hash64_helper(entries[i].name, entries[i].len);
+    try {
+        perfect = new PerfectHash(keys);
+    } catch (PerfectHash::BuildException& e) {
+        cwarning << "Not using a perfect hash: " << e.what() << endl;
+        return;
+    }
+    vector<Entry> placed(entries.size());
+    for (size_t i = 0; i < entries.size(); i++)
+        placed[perfect->lookup(keys[i])] = entries[i];
+    entries.swap(placed);
+    vector<uint32_t>().swap(slots);
 }
 
-bool DnsResolver::Cache::full() const {
-    return local_list.size() == maxsize;
+size_t DnsResolver::Index::Part::size() const { return entries.size(); }
+
+// WildcardTrie nested class
+
+DnsResolver::WildcardTrie::WildcardTrie(unsigned int maxialiases)
+    : maxipaliases(maxialiases), wildcards(0), slots(16, 0) {
+    Node root;
+    root.parent = NONE;
+    root.edge = root.len = 0;
+    root.addr = NONE;
+    root.naddrs = 0;
+    nodes.push_back(root);
 }
 
-inline size_t DnsResolver::Cache::get_maxsize() const {return maxsize;}
+DnsResolver::WildcardTrie::WildcardTrie(const WildcardTrie& src){} // private copy constructor does nothing
 
-inline size_t DnsResolver::Cache::get_maxialiases() const {return maxipaliases;}
+bool DnsResolver::WildcardTrie::is_wildcard(const char* name, size_t len){
+    return len > 2 && name[0] == '*' && name[1] == '.';
+}
 
-inline time_t DnsResolver::Cache::get_file_mtime() const { return file_mtime; }
+static inline uint32_t child_hash(uint32_t parent, const char* label, size_t len){
+    return hash_helper(label, len) ^ (parent * 0x9E3779B1u);
+}
 
-string DnsResolver::Cache::print_head() const {
-    if (local_list.size() > 0)
-        return (local_list.front())->first;
+// the slot of parent's child whose edge starts with label, or the empty slot
+// where it should go
+size_t DnsResolver::WildcardTrie::find_slot(uint32_t parent, const char* label, size_t len) const {
+    size_t mask = slots.size() - 1;
+    size_t pos = child_hash(parent, label, len) & mask;
+    while (slots[pos] != 0) {
+        const Node& node = nodes[slots[pos] - 1];
+        if (node.parent == parent && node.len > len && pool[node.edge + len] == '.' &&
+            memcmp(&pool[node.edge], label, len) == 0)
+            break;
+        pos = (pos + 1) & mask;
+    }
+    return pos;
+}
+
+uint32_t DnsResolver::WildcardTrie::find_child(uint32_t parent, const char* label, size_t len) const {
+    size_t pos = find_slot(parent, label, len);
+    return (slots[pos] == 0) ? NONE : slots[pos] - 1;
+}
+
+uint32_t DnsResolver::WildcardTrie::add_child(uint32_t parent, uint32_t edge, uint32_t len){
+    Node node;
+    node.parent = parent;
+    node.edge = edge;
+    node.len = len;
+    node.addr = NONE;
+    node.naddrs = 0;
+    nodes.push_back(node);
+    size_t labellen = strchr(&pool[edge], '.') - &pool[edge];
+    slots[find_slot(parent, &pool[edge], labellen)] = nodes.size();
+    if (nodes.size() * 2 > slots.size())
+        grow();
+    return nodes.size() - 1;
+}
+
+void DnsResolver::WildcardTrie::add(const char* name, size_t len, struct in_addr ip){
+    // the key: labels after the "*.", last one first, each followed by a dot,
+    // in lowercase like the names looked up
+    uint32_t key = pool.size();
+    const char* end = name + len;
+    while (end > name + 2) {
+        const char* label = end;
+        while (label[-1] != '.')
+            label--;
+        size_t offset = pool.size();
+        pool.resize(offset + (end - label));
+        lowercase_helper(&pool[offset], label, end - label);
+        pool.push_back('.');
+        end = label - 1;
+    }
+    pool.push_back('\0'); // so that strchr() stops
+    uint32_t keyend = pool.size() - 1;
+
+    // walk down as far as the key matches, splitting the edge where it stops
+    uint32_t node = 0;
+    while (key < keyend) {
+        size_t labellen = strchr(&pool[key], '.') - &pool[key];
+        uint32_t child = find_child(node, &pool[key], labellen);
+        if (child == NONE) {
+            node = add_child(node, key, keyend - key);
+            break;
+        }
+        // common part of the edge and the key, in whole labels
+        uint32_t common = 0;
+        Node& c = nodes[child];
+        while (common < c.len && key + common < keyend && pool[c.edge + common] == pool[key + common])
+            common++;
+        while (common > 0 && pool[c.edge + common - 1] != '.')
+            common--;
+        if (common < c.len) {
+            // the new middle node takes over child's slot, child hangs from it
+            uint32_t edge = c.edge;
+            size_t pos = find_slot(node, &pool[key], labellen);
+            Node middle;
+            middle.parent = node;
+            middle.edge = edge;
+            middle.len = common;
+            middle.addr = NONE;
+            middle.naddrs = 0;
+            nodes.push_back(middle);
+            uint32_t m = nodes.size() - 1;
+            slots[pos] = m + 1;
+            nodes[child].parent = m;
+            nodes[child].edge += common;
+            nodes[child].len -= common;
+            const char* rest = &pool[nodes[child].edge];
+            slots[find_slot(m, rest, strchr(rest, '.') - rest)] = child + 1;
+            if (nodes.size() * 2 > slots.size())
+                grow();
+            child = m;
+        }
+        node = child;
+        key += common;
+    }
+
+    // append ip to the wildcard's addresses, unless it's already there
+    Node& wildcard = nodes[node];
+    if (wildcard.naddrs == 0)
+        wildcards++;
+    if (wildcard.naddrs >= maxipaliases)
+        return;
+    uint32_t last = NONE;
+    for (uint32_t i = wildcard.addr; i != NONE; i = addrs[i].next) {
+        if (addrs[i].ip.s_addr == ip.s_addr)
+            return;
+        last = i;
+    }
+    Addr addr;
+    addr.ip = ip;
+    addr.next = NONE;
+    addrs.push_back(addr);
+    if (last == NONE)
+        wildcard.addr = addrs.size() - 1;
     else
-        return "<none>";
+        addrs[last].next = addrs.size() - 1;
+    wildcard.naddrs++;
 }
 
-string DnsResolver::Cache::print_tail() const {
-    if (local_list.size() > 0)
-        return (local_list.back())->first;
+bool DnsResolver::WildcardTrie::lookup(const std::string& name, addr_set_t& result) const {
+    const char* begin = name.data();
+    // name's labels not matched yet are [begin, end)
+    const char* end = begin + name.size();
+    uint32_t node = 0;
+    uint32_t best = NONE;
+    while (end > begin) {
+        const char* label = end;
+        while (label > begin && label[-1] != '.')
+            label--;
+        uint32_t child = find_child(node, label, end - label);
+        if (child == NONE)
+            break;
+
+        // match the whole edge, label by label
+        const char* edge = &pool[nodes[child].edge];
+        const char* edgeend = edge + nodes[child].len;
+        while (edge < edgeend && end > begin) {
+            label = end;
+            while (label > begin && label[-1] != '.')
+                label--;
+            size_t len = end - label;
+            if ((size_t) (edgeend - edge) <= len || edge[len] != '.' || memcmp(edge, label, len) != 0)
+                break;
+            edge += len + 1;
+            end = (label > begin) ? label - 1 : begin;
+        }
+        if (edge < edgeend)
+            break;
+        node = child;
+        // a wildcard stands for one label at least
+        if (nodes[node].naddrs > 0 && end > begin)
+            best = node;
+    }
+    if (best == NONE)
+        return false;
+    for (uint32_t i = nodes[best].addr; i != NONE; i = addrs[i].next)
+        result.insert(addrs[i].ip);
+    return true;
+}
+
+// double the slot table and rehash, nodes themselves don't move
+void DnsResolver::WildcardTrie::grow(){
+    vector<uint32_t> old;
+    old.swap(slots);
+    slots.assign(old.size() * 2, 0);
+    size_t mask = slots.size() - 1;
+    for (size_t i = 0; i < old.size(); i++) {
+        if (old[i] == 0) continue;
+        const Node& node = nodes[old[i] - 1];
+        const char* label = &pool[node.edge];
+        size_t pos = child_hash(node.parent, label, strchr(label, '.') - label) & mask;
+        while (slots[pos] != 0)
+            pos = (pos + 1) & mask;
+        slots[pos] = old[i];
+    }
+}
+
+size_t DnsResolver::WildcardTrie::size() const { return wildcards; }
+
+// ReverseIndex nested class
+
+DnsResolver::ReverseIndex::ReverseIndex(unsigned int _maxnames)
+    : maxnames(_maxnames), slots(16, 0) {}
+
+DnsResolver::ReverseIndex::ReverseIndex(const ReverseIndex& src){} // private copy constructor does nothing
+
+static inline uint32_t address_hash(struct in_addr address){
+    uint32_t h = address.s_addr * 0x9E3779B1u;
+    return h ^ (h >> 16);
+}
+
+size_t DnsResolver::ReverseIndex::find_slot(struct in_addr address) const {
+    size_t mask = slots.size() - 1;
+    size_t pos = address_hash(address) & mask;
+    while (slots[pos] != 0 && entries[slots[pos] - 1].address.s_addr != address.s_addr)
+        pos = (pos + 1) & mask;
+    return pos;
+}
+
+void DnsResolver::ReverseIndex::add(struct in_addr address, const char* name, size_t len){
+    size_t pos = find_slot(address);
+    if (slots[pos] == 0) {
+        Entry entry;
+        entry.address = address;
+        entry.head = entry.tail = NONE;
+        entry.nnames = 0;
+        entries.push_back(entry);
+        slots[pos] = entries.size();
+        if (entries.size() * 2 > slots.size()) {
+            grow();
+            pos = find_slot(address);
+        }
+    }
+
+    // append name to the address's list, unless it's already there
+    Entry& entry = entries[slots[pos] - 1];
+    if (entry.nnames >= maxnames)
+        return;
+    for (uint32_t i = entry.head; i != NONE; i = names[i].next)
+        if (names[i].len == len && nocase_equal_helper(&pool[names[i].offset], name, len))
+            return;
+    Name added;
+    added.offset = pool.size();
+    added.len = len;
+    added.next = NONE;
+    pool.resize(pool.size() + len);
+    lowercase_helper(&pool[added.offset], name, len);
+    names.push_back(added);
+    if (entry.tail == NONE)
+        entry.head = names.size() - 1;
     else
-        return "<none>";
+        names[entry.tail].next = names.size() - 1;
+    entry.tail = names.size() - 1;
+    entry.nnames++;
 }
 
+bool DnsResolver::ReverseIndex::lookup(struct in_addr address, name_list_t& result) const {
+    size_t pos = find_slot(address);
+    if (slots[pos] == 0)
+        return false;
+    for (uint32_t i = entries[slots[pos] - 1].head; i != NONE; i = names[i].next)
+        result.push_back(string(&pool[names[i].offset], names[i].len));
+    return true;
+}
+
+void DnsResolver::ReverseIndex::grow(){
+    vector<uint32_t> old;
+    old.swap(slots);
+    slots.assign(old.size() * 2, 0);
+    size_t mask = slots.size() - 1;
+    for (size_t i = 0; i < old.size(); i++) {
+        if (old[i] == 0) continue;
+        size_t pos = address_hash(entries[old[i] - 1].address) & mask;
+        while (slots[pos] != 0)
+            pos = (pos + 1) & mask;
+        slots[pos] = old[i];
+    }
+}
+
+size_t DnsResolver::ReverseIndex::size() const { return entries.size(); }
+
 // ResolveException nested class
 
 DnsResolver::ResolveException::ResolveException(const char* s)
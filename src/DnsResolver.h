@@ -5,16 +5,26 @@
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
+#include <new>
 
 #include <utility>
 #include <list>
-#include <set>
 #include <map>
+#include <set>
+#include <vector>
 
 // libc includes
 #include <sys/types.h>
+#include <stdint.h>
 #include <arpa/inet.h>
 
+// Project includes
+#include "HostsFile.h"
+#include "HostsImage.h"
+#include "FileWatcher.h"
+#include "BloomFilter.h"
+#include "PerfectHash.h"
+#include "Thread.h"
 
 // Probably could get this class to be nested somewhere inside DnsResolver, but
 // that takes too much typedef-engineering...
@@ -26,6 +36,7 @@ public:
 };
 
 typedef std::set<struct in_addr, in_addr_cmp> addr_set_t;
+typedef std::vector<std::string> name_list_t;
 
 class DnsResolver {
 public:
@@ -42,85 +53,686 @@ public:
         static const ssize_t MAXERRNOMSG=200;
     };
 
+    // cache policies, see the nested cache classes
+    enum CachePolicy {
+        CACHE_LRU,
+        CACHE_CLOCK,
+        CACHE_TINYLFU,
+        CACHE_ARC,
+        CACHE_POLICIES
+    };
+    static const char* const CACHE_POLICY_NAMES[CACHE_POLICIES];
+    static CachePolicy parse_cache_policy(const std::string& name) throw (ResolveException);
+
     // public constructor/destructor
     DnsResolver(
         const std::string& filename,
         const unsigned int maxsize = DEFAULT_CACHE_SIZE[0],
         const unsigned int maxaliases = DEFAULT_MAX_ALIASES[0],
         const unsigned int maxialiases = DEFAULT_MAX_INVERSE_ALIASES[0],
-        const bool nostatflag = DEFAULT_NOSTATFLAG) throw (ResolveException);
+        const bool nostatflag = DEFAULT_NOSTATFLAG,
+        const bool indexflag = DEFAULT_INDEXFLAG,
+        const unsigned int shards = DEFAULT_CACHE_SHARDS[0],
+        const CachePolicy policy = DEFAULT_CACHE_POLICY,
+        const unsigned int negsize = DEFAULT_NEGATIVE_CACHE_SIZE[0],
+        const bool perfectflag = DEFAULT_PERFECTFLAG,
+        const unsigned int loadthreads = DEFAULT_LOAD_THREADS[0]) throw (ResolveException);
     ~DnsResolver();
 
     // public members
     std::string resolve_to_string(const std::string& what) throw (ResolveException);
-    const addr_set_t* resolve(const std::string& address) throw (ResolveException);
+    // false if name is not in the hosts file. Names match regardless of case.
+    bool resolve(const std::string& name, addr_set_t& result) throw (ResolveException);
+    // the same for a name already lowercased by lowercase_helper(), which
+    // returned hash
+    bool resolve(const std::string& name, uint64_t hash, addr_set_t& result) throw (ResolveException);
+    // the same as ready-made answer records, see ANSWER_RECORD_SIZE. As many
+    // as fit in buflen are copied to answers, count gets how many there are
+    bool resolve(const std::string& name, uint64_t hash, char* answers, size_t buflen, size_t& count) throw (ResolveException);
+    // the names of address, in file order, false if it is not in the hosts
+    // file. Never scans the file.
+    bool resolve_address(const struct in_addr& address, name_list_t& result) throw (ResolveException);
+    // write the cached names to path, the most recently used first, and
+    // return how many
+    size_t save_cache(const std::string& path) throw (ResolveException);
+    // resolve the names a save_cache() left in path, so that they are cached
+    // again. Missing or corrupt dumps are ignored. Returns the names found.
+    size_t warm_cache(const std::string& path) throw (ResolveException);
+
+    // cache statistics since startup, across reloads
+    unsigned long cache_hits() const;
+    unsigned long cache_misses() const;
+    unsigned long negative_hits() const;
+    unsigned long filtered() const;
+    unsigned long wildcard_hits() const;
 
     // friends
     friend std::ostream& operator<<(std::ostream& os, const DnsResolver& dns);
 
     // constants
     static const unsigned int DEFAULT_CACHE_SIZE[3];
+    static const unsigned int DEFAULT_CACHE_SHARDS[3];
+    static const unsigned int DEFAULT_NEGATIVE_CACHE_SIZE[3];
+    static const CachePolicy DEFAULT_CACHE_POLICY;
     static const unsigned int DEFAULT_MAX_ALIASES[3];
     static const unsigned int DEFAULT_MAX_INVERSE_ALIASES[3];
     static const bool DEFAULT_NOSTATFLAG;
+    static const bool DEFAULT_INDEXFLAG;
+    static const bool DEFAULT_PERFECTFLAG;
+    static const unsigned int DEFAULT_LOAD_THREADS[3];
+    // an answer record is an A record in wire format: a compression pointer
+    // to the name of the first question of a message, type, class, a zero
+    // ttl, the data length and the address
+    static const size_t ANSWER_RECORD_SIZE = 16;
+    // the caches are allocated up front, and no bigger than this in all
+    static const uint64_t MAX_CACHE_BYTES = 4ULL << 30;
+    // no query can ask for a longer name, so none is ever cached
+    static const size_t MAX_NAME = 253;
 
 private:
 
-    // internal struct when parsing a line
-    struct DnsEntry {
-        struct in_addr ip;
-        std::list<std::string> aliases;
-    };
-
-    // Cache nested class
+    // Cache nested class, the interface to every cache policy. All of them
+    // are safe to use from any number of threads at once.
     class Cache {
     public:
-        Cache(unsigned int maxsize, unsigned int maxialiases, time_t file_mtime);
-        ~Cache();
+        virtual ~Cache();
 
         // public members
-        const addr_set_t* lookup(const std::string& name);
-        const addr_set_t* insert(std::string& name, struct in_addr ip);
+        // hash is hash_helper() of name
+        virtual bool lookup(const std::string& name, uint32_t hash, addr_set_t& result) throw (Thread::ThreadException) = 0;
+        // the same as answer records, like DnsResolver::resolve()
+        virtual bool lookup(const std::string& name, uint32_t hash, char* answers, size_t buflen, size_t& count) throw (Thread::ThreadException) = 0;
+        virtual void insert(const std::string& name, uint32_t hash, struct in_addr ip, bool evict = true) throw (Thread::ThreadException) = 0;
+        // whether insert() could add a name with hash without evicting. Told
+        // without locking, so only a hint
+        virtual bool has_room(uint32_t hash) const = 0;
+        // forget name, if it is there
+        virtual void erase(const std::string& name, uint32_t hash) throw (Thread::ThreadException) = 0;
+        // append the cached names, those most worth keeping first
+        virtual void names(std::vector<std::string>& result) const throw (Thread::ThreadException) = 0;
+        virtual size_t size() const = 0;
+        virtual const char* policy() const = 0;
+    };
+
+    // Store nested class, the entries of one cache shard in memory that is
+    // all allocated up front: a flat open-addressed table of entry
+    // indexes, the entries themselves with their name inline, and
+    // maxialiases answer records per entry in one array. Entries sit on one of
+    // a few queues, intrusive lists linked by entry index. Adding and
+    // removing entries never allocates, but for the rare names longer than
+    // NAME_INLINE, whose tails are kept on the side.
+    class Store {
+    public:
+        Store(unsigned int capacity, unsigned int maxialiases);
+
+        static const uint32_t NONE = 0xFFFFFFFF;
+        static const unsigned int QUEUES = 4;
+        // the part of a name kept in its entry
+        static const unsigned int NAME_INLINE = 112;
+
+        // bytes allocated per entry with maxialiases, table slots included
+        static size_t entry_size(unsigned int maxialiases);
+
+        // entry index of name, or NONE
+        uint32_t find(const std::string& name, uint32_t hash) const;
+        // add name to the front of queue, there must be room
+        uint32_t add(const std::string& name, uint32_t hash, unsigned int queue);
+        void remove(uint32_t e);
+        // move to the front of queue, which may be the entry's own
+        void move(uint32_t e, unsigned int queue);
+
+        unsigned int queue_of(uint32_t e) const;
+        uint32_t hash(uint32_t e) const;
+        uint32_t back(unsigned int queue) const;
+        // append the names on queue, front first
+        void names(unsigned int queue, std::vector<std::string>& result) const;
+        uint32_t queue_size(unsigned int queue) const;
+        uint32_t count() const;
         bool full() const;
-        size_t get_maxsize() const;
-        size_t get_maxialiases() const;
-        time_t get_file_mtime() const;
+
+        void add_address(uint32_t e, struct in_addr ip);
+        void clear_addresses(uint32_t e);
+        void addresses(uint32_t e, addr_set_t& result) const;
+        // copy as many answer records as fit in buflen in one go, return
+        // how many there are
+        size_t answers(uint32_t e, char* buff, size_t buflen) const;
+        std::ostream& print_name(std::ostream& os, uint32_t e) const;
+
+    private:
+        // 128 bytes, the hash and the start of the name share a cache line
+        struct Entry {
+            uint32_t hash;
+            uint32_t prev;
+            uint32_t next;
+            uint16_t naddrs;
+            unsigned char len; // at most MAX_NAME
+            unsigned char queue;
+            char name[NAME_INLINE];
+        };
+
+        struct Queue {
+            uint32_t head;
+            uint32_t tail;
+            uint32_t size;
+        };
+
+        size_t slot_of(uint32_t e) const;
+        void unlink(uint32_t e);
+        void push_front(uint32_t e, unsigned int queue);
+
+        unsigned int capacity;
+        unsigned int maxipaliases;
+
+        std::vector<uint32_t> slots; // entry index + 1, 0 is empty
+        std::vector<Entry> entries;
+        std::vector<char> records; // maxipaliases answer records per entry
+        std::map<uint32_t, std::string> tails; // of names past NAME_INLINE
+        Queue queues[QUEUES];
+        uint32_t free_list; // linked through next
+        uint32_t used;
+    };
+
+    // ShardedCache nested class, split into independently locked shards. A
+    // name always goes to the same shard, picked by its hash, and each shard
+    // runs the replacement policy on its own part of the cache.
+    class ShardedCache : public Cache {
+    public:
+        ShardedCache(CachePolicy policy, unsigned int maxsize, unsigned int maxialiases, unsigned int shards);
+        ~ShardedCache();
+
+        // public members
+        bool lookup(const std::string& name, uint32_t hash, addr_set_t& result) throw (Thread::ThreadException);
+        bool lookup(const std::string& name, uint32_t hash, char* answers, size_t buflen, size_t& count) throw (Thread::ThreadException);
+        void insert(const std::string& name, uint32_t hash, struct in_addr ip, bool evict = true) throw (Thread::ThreadException);
+        bool has_room(uint32_t hash) const;
+        void erase(const std::string& name, uint32_t hash) throw (Thread::ThreadException);
+        void names(std::vector<std::string>& result) const throw (Thread::ThreadException);
+        size_t size() const;
+        const char* policy() const;
 
     private:
-        // MapValue nested nested class and friends
-        class MapValue;
+        ShardedCache(const ShardedCache& src);
+
+        // Shard nested nested class, one replacement policy over a Store.
+        // Callers hold mutex.
+        class Shard {
+        public:
+            Shard(unsigned int capacity, unsigned int maxialiases);
+            virtual ~Shard();
+            // the entry of name in store, or Store::NONE. Counts as a hit
+            // for the policy
+            virtual uint32_t lookup(const std::string& name, uint32_t hash) = 0;
+            virtual void insert(const std::string& name, uint32_t hash, struct in_addr ip, bool evict) = 0;
+            virtual void erase(const std::string& name, uint32_t hash) = 0;
+            virtual void names(std::vector<std::string>& result) const = 0;
+            virtual size_t size() const = 0;
+            // whether an insert that may not evict would be refused
+            virtual bool full() const = 0;
 
-        typedef std::map<std::string, MapValue> map_t;
-        typedef std::list<map_t::iterator> list_t;
+            Thread::Mutex mutex;
+            Store store;
+        };
 
-        class MapValue {
+        // LruShard nested nested class, evicts the least recently used entry
+        class LruShard : public Shard {
         public:
-            MapValue(struct in_addr ip, std::list<map_t::iterator>::iterator li);
-            addr_set_t ips;
-            std::list<map_t::iterator>::iterator listiter;
+            LruShard(unsigned int maxsize, unsigned int maxialiases);
+            uint32_t lookup(const std::string& name, uint32_t hash);
+            void insert(const std::string& name, uint32_t hash, struct in_addr ip, bool evict);
+            void erase(const std::string& name, uint32_t hash);
+            void names(std::vector<std::string>& result) const;
+            size_t size() const;
+            bool full() const;
         };
 
+        // Sketch nested nested class, a count-min sketch of how often hashes
+        // were seen lately. All counts are halved every so often, so that
+        // names that were popular once fade away.
+        class Sketch {
+        public:
+            Sketch(unsigned int maxsize);
+            void increment(uint32_t hash);
+            unsigned int frequency(uint32_t hash) const;
+        private:
+            static const unsigned int ROWS = 4;
+            static const unsigned char MAXCOUNT = 15;
+            size_t index(uint32_t hash, unsigned int row) const;
+
+            std::vector<unsigned char> counters;
+            size_t mask;
+            unsigned long additions;
+            unsigned long sample;
+        };
+
+        // TinyLfuShard nested nested class, W-TinyLFU: new names go to a
+        // small LRU window, and whatever falls out of it only enters the main
+        // segmented LRU if it was seen more often than the entry it would
+        // evict there. A burst of one-off names never gets past the window.
+        class TinyLfuShard : public Shard {
+        public:
+            TinyLfuShard(unsigned int maxsize, unsigned int maxialiases);
+            uint32_t lookup(const std::string& name, uint32_t hash);
+            void insert(const std::string& name, uint32_t hash, struct in_addr ip, bool evict);
+            void erase(const std::string& name, uint32_t hash);
+            void names(std::vector<std::string>& result) const;
+            size_t size() const;
+            bool full() const;
+        private:
+            enum { WINDOW, PROBATION, PROTECTED };
+            void admit(uint32_t candidate);
+
+            Sketch sketch;
+            unsigned int maxsize;
+            unsigned int maxwindow;
+            unsigned int maxprotected;
+        };
+
+        // ArcShard nested nested class, adaptive replacement: names seen once
+        // and names seen again are kept in separate LRU lists, and the
+        // recently evicted names of each list are remembered without their
+        // addresses. A miss on one of these ghosts moves the balance between
+        // the two lists, so scans only ever evict names seen once.
+        class ArcShard : public Shard {
+        public:
+            ArcShard(unsigned int maxsize, unsigned int maxialiases);
+            uint32_t lookup(const std::string& name, uint32_t hash);
+            void insert(const std::string& name, uint32_t hash, struct in_addr ip, bool evict);
+            void erase(const std::string& name, uint32_t hash);
+            void names(std::vector<std::string>& result) const;
+            size_t size() const;
+            bool full() const;
+        private:
+            enum { T1, T2, B1, B2 };
+            void replace(bool inb2);
+
+            unsigned int maxsize;
+            unsigned int target; // wanted size of T1
+        };
+
+        CachePolicy cachepolicy;
+        std::vector<Shard*> shards;
+    };
+
+    // ClockCache nested class, a set-associative cache whose hits take no
+    // lock and write nothing but a reference bit, and only if it wasn't set
+    // already. Entries are immutable: inserts publish a new entry with an
+    // atomic pointer store and retire the one it replaces through rcu, and
+    // eviction picks a victim within the name's set with the CLOCK algorithm.
+    // Callers of lookup() must be in an rcu read section.
+    class ClockCache : public Cache {
+    public:
+        ClockCache(unsigned int maxsize, unsigned int maxialiases, Thread::Rcu& rcu);
+        ~ClockCache();
+
+        // public members
+        bool lookup(const std::string& name, uint32_t hash, addr_set_t& result) throw (Thread::ThreadException);
+        bool lookup(const std::string& name, uint32_t hash, char* answers, size_t buflen, size_t& count) throw (Thread::ThreadException);
+        void insert(const std::string& name, uint32_t hash, struct in_addr ip, bool evict = true) throw (Thread::ThreadException);
+        bool has_room(uint32_t hash) const;
+        void erase(const std::string& name, uint32_t hash) throw (Thread::ThreadException);
+        void names(std::vector<std::string>& result) const throw (Thread::ThreadException);
+        size_t size() const;
+        const char* policy() const;
+
+        static const unsigned int WAYS = 8;
+
+    private:
+        ClockCache(const ClockCache& src);
+
+        class Entry : public Thread::Rcu::Retired {
+        public:
+            Entry(const std::string& name, uint32_t hash);
+            void add_address(struct in_addr ip);
+            std::string name;
+            uint32_t hash;
+            // answer records, one per address
+            std::string records;
+        };
+
+        struct Set {
+            Entry* volatile ways[WAYS];
+            volatile unsigned char referenced[WAYS];
+            unsigned int hand;
+        };
+
+        void publish(Set& set, unsigned int way, Entry* entry);
+
+        // writers lock one of a few mutexes, picked by set
+        static const unsigned int STRIPES = 64;
+
         unsigned int maxsize;
         unsigned int maxipaliases;
-        time_t file_mtime;
+        Thread::Rcu& rcu;
+        std::vector<Set> sets;
+        volatile size_t count;
+        Thread::Mutex* stripes;
+    };
+
+    // NegativeCache nested class, the names lately found missing from the
+    // hosts file, split into independently locked shards like ShardedCache.
+    // Each shard forgets its least recently asked for name once full.
+    class NegativeCache {
+    public:
+        NegativeCache(unsigned int maxsize, unsigned int shards);
+        ~NegativeCache();
+
+        bool lookup(const std::string& name, uint32_t hash) throw (Thread::ThreadException);
+        void insert(const std::string& name, uint32_t hash) throw (Thread::ThreadException);
+
+    private:
+        NegativeCache(const NegativeCache& src);
+
+        struct Shard {
+            Shard(unsigned int maxsize);
+            Store store;
+            Thread::Mutex mutex;
+        };
+
+        std::vector<Shard*> shards;
+    };
+
+    // WildcardTrie nested class, the hosts file's wildcard names, like
+    // *.internal.example, which stands for any name ending in
+    // .internal.example, with at least one label before that. A name matches
+    // the longest such suffix.
+    //
+    // A compressed trie keyed on reversed labels: an edge holds one or more
+    // whole labels, last one first, each followed by a dot, so
+    // *.internal.example is the edge "example.internal." from the root. A
+    // node's children are found through a single hash table keyed by parent
+    // and first label, so a lookup takes time proportional to the number of
+    // labels in the name, whatever the number of wildcards.
+    class WildcardTrie {
+    public:
+        WildcardTrie(unsigned int maxialiases);
+
+        // public members
+        static bool is_wildcard(const char* name, size_t len);
+        void add(const char* name, size_t len, struct in_addr ip);
+        bool lookup(const std::string& name, addr_set_t& result) const;
+        size_t size() const;
+
+    private:
+        WildcardTrie(const WildcardTrie& src);
+
+        struct Node {
+            uint32_t parent;
+            // the edge from parent, in pool
+            uint32_t edge;
+            uint32_t len;
+            // head of this node's address chain, if it is a wildcard
+            uint32_t addr;
+            uint32_t naddrs;
+        };
+
+        struct Addr {
+            struct in_addr ip;
+            uint32_t next;
+        };
+
+        uint32_t add_child(uint32_t parent, uint32_t edge, uint32_t len);
+        uint32_t find_child(uint32_t parent, const char* label, size_t len) const;
+        size_t find_slot(uint32_t parent, const char* label, size_t len) const;
+        void grow();
+
+        static const uint32_t NONE = 0xFFFFFFFF;
+
+        unsigned int maxipaliases;
+        size_t wildcards;
+        // node 0 is the root
+        std::vector<Node> nodes;
+        // children, by parent and first label: node index plus one, 0 is empty
+        std::vector<uint32_t> slots;
+        std::vector<Addr> addrs;
+        std::vector<char> pool;
+    };
 
-        std::string print_head() const;
-        std::string print_tail() const;
+    // ReverseIndex nested class, the names of every address in the hosts file,
+    // for PTR queries. Filled in the same pass that parses the file for the
+    // index or the Bloom filter, with its own copy of the names. An address
+    // keeps the first maxnames distinct names it appears with.
+    class ReverseIndex {
+    public:
+        ReverseIndex(unsigned int maxnames);
 
-        friend std::ostream& operator<<(std::ostream& os, const DnsResolver& dns);
+        // public members
+        void add(struct in_addr address, const char* name, size_t len);
+        bool lookup(struct in_addr address, name_list_t& result) const;
+        size_t size() const;
+
+    private:
+        ReverseIndex(const ReverseIndex& src);
+
+        struct Entry {
+            struct in_addr address;
+            // first and last of this address's names
+            uint32_t head;
+            uint32_t tail;
+            uint32_t nnames;
+        };
+
+        struct Name {
+            uint32_t offset;
+            uint32_t len;
+            uint32_t next;
+        };
 
-        map_t local_map;
-        list_t local_list;
+        size_t find_slot(struct in_addr address) const;
+        void grow();
+
+        static const uint32_t NONE = 0xFFFFFFFF;
+
+        unsigned int maxnames;
+        // slots hold an index into entries plus one, 0 marks an empty slot
+        std::vector<uint32_t> slots;
+        std::vector<Entry> entries;
+        std::vector<Name> names;
+        std::vector<char> pool;
     };
 
-    int parse_line(const std::string& line, DnsEntry& parsed) throw (ResolveException);
+    // Index nested class, a flat open-addressed hash table of every name in
+    // the hosts file, built once per file modification. Names are not copied,
+    // entries point into the file's copy in memory, which the index owns.
+    //
+    // With perfect set, the entries are then reordered by a PerfectHash of
+    // their names and the slots dropped, so that a lookup is one hash and
+    // one compare.
+    //
+    // A large file is loaded by up to threads threads at once. It is split
+    // at line boundaries into one chunk per thread, and each thread first
+    // tokenizes and hashes a chunk, then builds one part of the index: the
+    // names whose hash falls in it, taken from every chunk in file order. One
+    // more thread fills the reverse index and the wildcards, also in file
+    // order, so that every table ends up as a single thread would build it.
+    class Index {
+    public:
+        Index(HostsFile* file, unsigned int maxaliases, unsigned int maxialiases, ReverseIndex& reverse,
+              WildcardTrie& wildcards, bool perfectflag = false, unsigned int threads = 1);
+        ~Index();
+
+        // public members
+        // hash is hash64_helper() of name
+        bool lookup(const std::string& name, uint64_t hash, addr_set_t& result) const;
+        void add_names(BloomFilter& filter) const;
+        size_t size() const;
+        const HostsFile& hosts() const;
+
+        // chunks are never smaller than this, so small files load in one go
+        static const size_t MIN_CHUNK = 1 << 20;
+
+    private:
+        Index(const Index& src);
 
+        // a name as tokenized, along with its hash64_helper()
+        struct Parsed {
+            const char* name;
+            uint32_t len;
+            struct in_addr ip;
+            uint64_t hash;
+        };
+
+        // Chunk nested nested class, tokenizes [begin, end) of the file
+        class Chunk : public Thread::Runnable {
+        public:
+            Chunk(const char* begin, const char* end, unsigned int maxaliases, unsigned int parts);
+            void* main();
+
+            // in file order, and by part as indexes into names
+            std::vector<Parsed> names;
+            std::vector<std::vector<uint32_t> > parts;
+        private:
+            const char* begin;
+            const char* end;
+            unsigned int maxaliases;
+        };
+
+        // Part nested nested class, the names of one part
+        class Part : public Thread::Runnable {
+        public:
+            Part(unsigned int number, const std::vector<Chunk*>& chunks, unsigned int maxialiases, bool perfectflag);
+            ~Part();
+            void* main();
+
+            bool lookup(const std::string& name, uint64_t hash, addr_set_t& result) const;
+            void add_names(BloomFilter& filter) const;
+            size_t size() const;
+
+        private:
+            Part(const Part& src);
+
+            struct Entry {
+                uint32_t hash;
+                uint32_t len;
+                const char* name;
+                // head of this name's chain in addrs, and its length
+                uint32_t addr;
+                uint32_t naddrs;
+            };
+
+            struct Addr {
+                struct in_addr ip;
+                uint32_t next;
+            };
+
+            void insert(const Parsed& name);
+            size_t find_slot(const char* name, size_t len, uint32_t hash) const;
+            void grow();
+            void make_perfect();
+
+            unsigned int number;
+            const std::vector<Chunk*>& chunks;
+            unsigned int maxipaliases;
+            bool perfectflag;
+
+            // slots hold an index into entries plus one, 0 marks an empty slot
+            std::vector<uint32_t> slots;
+            std::vector<Entry> entries;
+            std::vector<Addr> addrs;
+            // replaces slots when not NULL
+            PerfectHash* perfect;
+        };
+
+        // Ordered nested nested class, fills the reverse index and the
+        // wildcards from every chunk in file order
+        class Ordered : public Thread::Runnable {
+        public:
+            Ordered(const std::vector<Chunk*>& chunks, ReverseIndex& reverse, WildcardTrie& wildcards);
+            void* main();
+        private:
+            const std::vector<Chunk*>& chunks;
+            ReverseIndex& reverse;
+            WildcardTrie& wildcards;
+        };
+
+        static void run_all(const std::vector<Thread::Runnable*>& tasks);
+
+        static const uint32_t NONE = 0xFFFFFFFF;
+
+        HostsFile* file;
+        std::vector<Part*> parts;
+    };
+
+    // Snapshot nested struct, everything derived from one version of the
+    // hosts file. Published snapshots are only ever replaced as a whole,
+    // but the cache may be handed on from one to the next when a reload
+    // keeps it.
+    struct Snapshot {
+        Snapshot();
+        ~Snapshot();
+
+        // the file in scan and index mode, NULL for images
+        const HostsFile* hosts() const;
+
+        Cache* cache;
+        // the image if the file is one, the index in index mode, the file
+        // to scan otherwise, along with the names it was scanned for in vain
+        HostsImage* image;
+        Index* index;
+        HostsFile* file;
+        NegativeCache* negative;
+        // addresses to names, except for images, which have their own
+        ReverseIndex* reverse;
+        // NULL if the file has no wildcard names
+        WildcardTrie* wildcards;
+        // every name in this version of the file, and then some. An
+        // image's own filter is used in place
+        const BloomFilter* filter;
+    };
+
+    // Reloader nested class, builds a new snapshot in its own thread whenever
+    // the file watcher says so, while queries keep being answered from the
+    // current one. Also frees whatever caches retire.
+    class Reloader : public Thread::Runnable, public FileWatcher::Listener {
+    public:
+        Reloader(DnsResolver& resolver);
+        void* main();
+        void file_changed();
+        void collect();
+        void stop();
+    private:
+        DnsResolver& resolver;
+        Thread::Semaphore requests;
+        volatile bool stop_flag;
+    };
+
+    bool search(Snapshot* snapshot, const std::string& name, uint64_t hash, addr_set_t& result) throw (ResolveException, Thread::ThreadException);
+    bool fetch(Snapshot* snapshot, const std::string& name, uint64_t hash, addr_set_t& result) throw (ResolveException, Thread::ThreadException);
+    // with a new cache, or with none when the caller decides on one
+    Snapshot* load_snapshot(bool withcache = true) throw (ResolveException);
+    bool changed_names(const HostsFile& before, const HostsFile& after,
+                       std::vector<std::pair<std::string, uint32_t> >& names) const;
+    BloomFilter* scan_names(const HostsFile& file, ReverseIndex& reverse, WildcardTrie& wildcards);
+    Cache* new_cache() throw (Thread::ThreadException, std::bad_alloc);
+    void reload();
+
+    unsigned int maxsize;
+    unsigned int shards;
+    CachePolicy policy;
+    unsigned int negsize;
     unsigned int maxaliases;
+    unsigned int maxialiases;
     std::string filename;
     bool nostatflag;
+    bool indexflag;
+    bool perfectflag;
+    unsigned int loadthreads;
+
+    // current is read by any thread inside an rcu read section, and only
+    // replaced by the reloader thread
+    Snapshot* volatile current;
+    volatile int reload_pending;
+    volatile int collect_pending;
+    Thread::Rcu rcu;
+    Thread::Counter hits;
+    Thread::Counter misses;
+    Thread::Counter neghits;
+    Thread::Counter filterhits;
+    Thread::Counter wildhits;
 
-    std::ifstream* file;
-    Cache* cache;
+    Reloader reloader;
+    Thread reloader_thread;
+    FileWatcher watcher;
+    Thread watcher_thread;
 };
 
 #endif // DNS_RESOLVER_H
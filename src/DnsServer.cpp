@@ -20,6 +20,7 @@ using namespace std;
 
 // statics
 Thread::Semaphore DnsServer::stop_sem;
+volatile sig_atomic_t DnsServer::report_requests = 0;
 
 // init of static consts
 const char DnsServer::DEFAULT_HOSTS_FILE[MAX_FILE_NAME] = "/etc/hosts";
@@ -28,6 +29,7 @@ const unsigned int DnsServer::DEFAULT_TCP_PORT[3] = {53, 1, 65000};
 const unsigned int DnsServer::DEFAULT_UDP_WORKERS[3] = {1, 0, 50};
 const unsigned int DnsServer::DEFAULT_TCP_WORKERS[3] = {5, 0, 50};
 const unsigned int DnsServer::DEFAULT_TCP_TIMEOUT[3] = {2, 0, 300};
+const unsigned int DnsServer::DEFAULT_DUMP_INTERVAL[3] = {60, 1, 86400};
 
 // class members definition
 
@@ -37,10 +39,21 @@ DnsServer::DnsServer (
     const unsigned int tcpport = DEFAULT_TCP_PORT[0],
     const unsigned int udpworkers = DEFAULT_UDP_WORKERS[0],
     const unsigned int tcpworkers = DEFAULT_TCP_WORKERS[0],
-    const unsigned int tcptimeout = DEFAULT_TCP_TIMEOUT[0])
+    const unsigned int tcptimeout = DEFAULT_TCP_TIMEOUT[0],
+    const string& dumpfile = "",
+    const unsigned int dumpinterval = DEFAULT_DUMP_INTERVAL[0])
     throw(std::exception)
-    {
+    : resolver(resolver), keeper(resolver, dumpfile, dumpinterval), keeper_thread(keeper),
+      keeping(false) {
+
+        // the cache warms up while the sockets are set up, workers wait
+        // for it in start()
+        if (!dumpfile.empty()) {
+            keeper_thread.run();
+            keeping = true;
+        }
 
+        try {
         if (udpworkers > 0){
             int on = 1;
             udp_serversocket.setsockopt (SOL_SOCKET, SO_REUSEADDR, (const char*) &on, sizeof (on));
@@ -53,15 +66,20 @@ DnsServer::DnsServer (
             tcp_serversocket.bind_any(tcpport);
             tcp_serversocket.listen();
         }
+        } catch (...) {
+            stop_keeper();
+            throw;
+        }
 
         for (unsigned int i=0; i < udpworkers; i++)
-            workers.push_back(new UdpWorker(resolver, udp_serversocket, resolve_mutex));
+            workers.push_back(new UdpWorker(resolver, udp_serversocket));
 
         for (unsigned int i=0; i < tcpworkers; i++)
-            workers.push_back(new TcpWorker(resolver, tcp_serversocket, accept_mutex, resolve_mutex, tcptimeout));
+            workers.push_back(new TcpWorker(resolver, tcp_serversocket, accept_mutex, tcptimeout));
     }
 
 DnsServer::~DnsServer(){
+    stop_keeper();
     for (list<DnsWorker*>::iterator iter = workers.begin(); iter != workers.end(); iter++)
         delete *iter;
 }
@@ -70,6 +88,16 @@ void DnsServer::start() throw (std::runtime_error){
     cwarning << "installing signal handlers..." << endl;
     signal_helper(SIGTERM, DnsServer::sig_term_handler);
     signal_helper(SIGINT, DnsServer::sig_term_handler);
+    signal_helper(SIGUSR1, DnsServer::sig_usr1_handler);
+
+    if (keeping) {
+        ctrace << "waiting for the cache to warm up..." << endl;
+        try {
+            keeper.wait_warm();
+        } catch (Thread::ThreadException& e){
+            throw std::runtime_error(e.what());
+        }
+    }
 
     list<Thread> threads;
     ctrace << "creating worker threads..." << endl;
@@ -84,7 +112,14 @@ void DnsServer::start() throw (std::runtime_error){
 
     try {
         ctrace << "waiting on exit semaphore..." << endl;
-        DnsServer::stop_sem.wait();
+        // SIGUSR1 posts it too, asking for the resolver's statistics
+        while (true) {
+            DnsServer::stop_sem.wait();
+            if (DnsServer::report_requests == 0)
+                break;
+            DnsServer::report_requests = 0;
+            cout << "\t\t" << resolver << endl;
+        }
     } catch (Thread::ThreadException& e){
         throw std::runtime_error(e.what());
     }
@@ -120,10 +155,73 @@ void DnsServer::start() throw (std::runtime_error){
 
     ctrace << "all threads joined" << endl;
 
+    // saves the cache one last time
+    stop_keeper();
+
     ctrace << "worker status:" << endl << endl;
     for (list<DnsWorker*>::iterator iter = workers.begin(); iter != workers.end(); iter++){
         cout << "\t\t" << (*iter)->report() << endl;
     }
+    cout << "\t\t" << resolver << endl;
+}
+
+void DnsServer::stop_keeper(){
+    if (!keeping)
+        return;
+    keeping = false;
+    keeper.stop();
+    try {
+        keeper_thread.join(NULL);
+    } catch (Thread::ThreadException& e) {
+        cerror << "Could not join cache keeper: " << e.what() << endl;
+    }
+}
+
+// CacheKeeper nested class
+
+DnsServer::CacheKeeper::CacheKeeper(DnsResolver& r, const string& p, unsigned int i)
+    : resolver(r), path(p), interval(i), stop_flag(false) {}
+
+DnsServer::CacheKeeper::CacheKeeper(const CacheKeeper& src) : resolver(src.resolver) {} // private copy constructor does nothing
+
+void* DnsServer::CacheKeeper::main(){
+    try {
+        resolver.warm_cache(path);
+    } catch (DnsResolver::ResolveException& e) {
+        cwarning << "Could not warm the cache up from \'" << path << "\': " << e.what() << endl;
+    }
+    try {
+        warmed.post();
+        // a post is a request to stop
+        while (!requests.timed_wait(interval) && !stop_flag)
+            save();
+    } catch (Thread::ThreadException& e) {
+        cerror << "Cache keeper could not wait: " << e.what() << endl;
+    }
+    save();
+    return NULL;
+}
+
+// a dump that can't be written now may be next time
+void DnsServer::CacheKeeper::save(){
+    try {
+        resolver.save_cache(path);
+    } catch (DnsResolver::ResolveException& e) {
+        cerror << "Could not save the cache to \'" << path << "\': " << e.what() << endl;
+    }
+}
+
+void DnsServer::CacheKeeper::wait_warm() throw (Thread::ThreadException){
+    warmed.wait();
+}
+
+void DnsServer::CacheKeeper::stop(){
+    stop_flag = true;
+    try {
+        requests.post();
+    } catch (Thread::ThreadException& e) {
+        cerror << "Could not stop cache keeper: " << e.what() << endl;
+    }
 }
 
 // SIGTERM and SIGINT signal handlers
@@ -132,6 +230,13 @@ void DnsServer::sig_term_handler(int signo){
     return;
 }
 
+// SIGUSR1 signal handler
+void DnsServer::sig_usr1_handler(int signo){
+    DnsServer::report_requests = 1;
+    DnsServer::stop_sem.post();
+    return;
+}
+
     
 
 
@@ -6,6 +6,7 @@
 #include <list>
 #include <stdexcept>
 #include <semaphore.h>
+#include <signal.h>
 
 // Project includes
 #include "Socket.h"
@@ -22,7 +23,9 @@ public:
         const unsigned int tcpport,
         const unsigned int udpworkers,
         const unsigned int tcpworkers,
-        const unsigned int tcptimeout) throw (std::exception);
+        const unsigned int tcptimeout,
+        const std::string& dumpfile,
+        const unsigned int dumpinterval) throw (std::exception);
     ~DnsServer();
     
     void start() throw (std::runtime_error);
@@ -37,20 +40,51 @@ public:
     static const unsigned int DEFAULT_UDP_WORKERS[3];
     static const unsigned int DEFAULT_TCP_WORKERS[3];
     static const unsigned int DEFAULT_TCP_TIMEOUT[3];
+    static const unsigned int DEFAULT_DUMP_INTERVAL[3];
 
 private:
 
+    // CacheKeeper nested class, warms the resolver's cache up from a dump
+    // file, then saves the cache there every interval seconds and once more
+    // when stopped
+    class CacheKeeper : public Thread::Runnable {
+    public:
+        CacheKeeper(DnsResolver& resolver, const std::string& path, unsigned int interval);
+        void* main();
+        // blocks until the warm-up is over
+        void wait_warm() throw (Thread::ThreadException);
+        void stop();
+    private:
+        CacheKeeper(const CacheKeeper& src);
+        void save();
+
+        DnsResolver& resolver;
+        std::string path;
+        unsigned int interval;
+        Thread::Semaphore warmed;
+        Thread::Semaphore requests;
+        volatile bool stop_flag;
+    };
+
+    void stop_keeper();
+
     // Static 
     static void sig_alarm_handler(int signo);
     static void sig_term_handler(int signo);
+    static void sig_usr1_handler(int signo);
 
     // Member attributes
+    DnsResolver& resolver;
     std::list<DnsWorker*> workers;
 
     bool stopFlag;
     static Thread::Semaphore stop_sem;
+    static volatile sig_atomic_t report_requests;
     Thread::Mutex accept_mutex;
-    Thread::Mutex resolve_mutex;
+
+    CacheKeeper keeper;
+    Thread keeper_thread;
+    bool keeping;
     
     TcpSocket tcp_serversocket;
     UdpSocket udp_serversocket;
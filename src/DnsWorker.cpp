@@ -11,8 +11,8 @@
 
 using namespace std;
 
-DnsWorker::DnsWorker(DnsResolver& _resolver, Thread::Mutex &_resolve_mutex, const size_t _maxmessage)
-    : resolver(_resolver), maxmessage(_maxmessage), resolve_mutex(_resolve_mutex){
+DnsWorker::DnsWorker(DnsResolver& _resolver, const size_t _maxmessage)
+    : maxmessage(_maxmessage), resolver(_resolver){
 
     retval = -1;
     id = uniqueid++;
@@ -39,6 +39,8 @@ void* DnsWorker::main(){
 
 void DnsWorker::stop(){ stop_flag = true; }
 
+size_t DnsWorker::maxResponse(const DnsQuery& query) const { return maxmessage; }
+
 string DnsWorker::what() const{
     stringstream ss;
     ss << "["<< name() << ": id = \'" << id << "\' tid = x" << hex << Thread::self() << dec << "]";
@@ -78,34 +80,29 @@ void DnsWorker::work(){
                     size_t read = readQuery(temp, maxmessage);
                     if (read == 0)
                         throw Socket::SocketException(TRACELINE("Read 0 bytes"));
-                    DnsMessage query(temp, read);
+                    // the query is parsed in place, nothing is copied
+                    DnsQuery query(temp, read);
                     ctrace << this->what() << ": read " << read << " byte long query:" << query << endl;
 
-                    // B.2 Answer query, serialize and send response
+                    // B.2 Answer query in the same buffer and send response
                     //
-                    //     handle any exceptions while answering, unlock mutex
-                    //     and rethrow simply
+                    //     the resolver is safe to use from all workers at
+                    //     once, no locking needed here
                     //
-                    //     handle rethrow any exceptions while serializing,
-                    //     rethrow as SERVER_FAILURE. This should produce error
-                    //     message to client
+                    //     answers that don't fit are left out, with the TC
+                    //     bit set. Exceptions while serializing mean not
+                    //     even the questions fit, rethrow as SERVER_FAILURE.
+                    //     This should produce error message to client
                     //
                     try {
-                        resolve_mutex.lock();
-                        DnsResponse response (query, resolver, maxmessage);
-                        resolve_mutex.unlock();
-                        size_t towrite = response.serialize(temp, maxmessage);
+                        size_t towrite = query.respond(resolver, temp, maxResponse(query));
                         size_t written = sendResponse(temp, towrite);
-                        ctrace << this->what() << ": sent " << written << " byte long response: " << response << endl;
+                        ctrace << this->what() << ": sent " << written << " byte long response" << endl;
                         served++;
-                    } catch (DnsMessage::DnsException& e){
-                        resolve_mutex.unlock();
-                        throw e;
                     } catch (DnsMessage::SerializeException& e){
-                        // TODO: Handle TC (Truncated bit) here.
-                        cerror << "response serialization failed" << endl;
+                        cerror << "response serialization failed: " << e.what() << endl;
                         ctrace << "throwing another exception to indicate server failure " << endl;
-                        throw DnsMessage::DnsException(query.getID(), DnsErrorResponse::SERVER_FAILURE, TRACELINE("TC not implemented yet"));
+                        throw DnsMessage::DnsException(query.id, DnsErrorResponse::SERVER_FAILURE, TRACELINE("Response won't fit"));
                     }
                     // B.3 Handle errors gracefully, responsing to client
                     // 
@@ -138,8 +135,8 @@ int DnsWorker::uniqueid = 0;
 
 // UdpWorker
 
-UdpWorker::UdpWorker(DnsResolver& resolver, const UdpSocket& s, Thread::Mutex& _resolvemutex, const size_t maxmessage) throw (Socket::SocketException)
-    : DnsWorker(resolver, _resolvemutex, maxmessage), socket(s) {}
+UdpWorker::UdpWorker(DnsResolver& resolver, const UdpSocket& s, const size_t maxmessage) throw (Socket::SocketException)
+    : DnsWorker(resolver, maxmessage), socket(s) {}
 
 void UdpWorker::setup(){
 } // Udp needs no special setup
@@ -155,6 +152,10 @@ size_t UdpWorker::sendResponse(const char* buff, const size_t maxmessage) throw
     return socket.sendto(buff, clientAddress, maxmessage);
 }
 
+// 512 bytes as RFC 1035 says, or more when the client asks for it with
+// EDNS0
+size_t UdpWorker::maxResponse(const DnsQuery& query) const { return query.udp_size(maxmessage); }
+
 string UdpWorker::name() const {return string("UdpWorker");}
 
 
@@ -162,9 +163,9 @@ string UdpWorker::name() const {return string("UdpWorker");}
 
 TcpWorker::TcpWorker(
     DnsResolver& resolver, const TcpSocket& socket, Thread::Mutex& acceptmutex,
-    Thread::Mutex& _resolvemutex, unsigned int timeout, const size_t maxmessage)
+    unsigned int timeout, const size_t maxmessage)
     throw ()
-    : DnsWorker(resolver, _resolvemutex, maxmessage),
+    : DnsWorker(resolver, maxmessage),
       serverSocket(socket),
       acceptMutex(acceptmutex)
 {
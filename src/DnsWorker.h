@@ -28,43 +28,45 @@ protected:
     virtual void   teardown() = 0;
     virtual size_t readQuery(char* buff, size_t maxmessage) throw(Socket::SocketException)= 0;
     virtual size_t sendResponse(const char* buff, size_t maxmessage) throw(Socket::SocketException)= 0;
+    // the largest response to query, maxmessage unless the transport says
+    // otherwise
+    virtual size_t maxResponse(const DnsQuery& query) const;
     virtual std::string name() const = 0;
 
     std::string what() const;
 
     void*   main ();
 
-    DnsWorker(DnsResolver& _resolver, Thread::Mutex &_resolve_mutex, const size_t _maxmessage);
+    DnsWorker(DnsResolver& _resolver, const size_t _maxmessage);
 
     int id;
     bool stop_flag;
+    const size_t maxmessage;
 
 private:
     static void sig_alrm_handler(int signo);
     
     DnsResolver& resolver;
 
-    const size_t maxmessage;
     int retval;
     static int uniqueid;
 
     unsigned int served;
     unsigned int served_error;
 
-    Thread::Mutex& resolve_mutex;
-    
     DnsWorker(const DnsWorker&);
 };
 
 class UdpWorker : public DnsWorker {
 public:
-    UdpWorker(DnsResolver& resolver, const UdpSocket& s, Thread::Mutex& resolvemutex, const size_t maxmessage=UdpSocket::DEFAULT_MAX_MSG)
+    UdpWorker(DnsResolver& resolver, const UdpSocket& s, const size_t maxmessage=DnsQuery::EDNS_PAYLOAD)
         throw (Socket::SocketException);
 
     void   setup();
     void   teardown();
     size_t readQuery(char* buff, size_t maxmessage) throw(Socket::SocketException);
     size_t sendResponse(const char* buff, size_t maxmessage) throw(Socket::SocketException);
+    size_t maxResponse(const DnsQuery& query) const;
     
 private:
     std::string name() const;
@@ -79,7 +81,7 @@ class TcpWorker : public DnsWorker{
 public:
     TcpWorker(
         DnsResolver& resolver, const TcpSocket& socket, Thread::Mutex& acceptmutex,
-        Thread::Mutex& resolvemutex, unsigned int timeout, const size_t maxmessage=TcpSocket::DEFAULT_MAX_MSG)
+        unsigned int timeout, const size_t maxmessage=TcpSocket::DEFAULT_MAX_MSG)
         throw ();
     ~TcpWorker() throw ();
 
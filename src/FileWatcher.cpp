@@ -0,0 +1,139 @@
+// libc includes
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+// Project includes
+#include "trace.h"
+#include "FileWatcher.h"
+
+// usings
+using namespace std;
+
+FileWatcher::FileWatcher(const std::string& f, Listener& l)
+    : filename(f), listener(l), stop_flag(false), fd(-1), dirwd(-1), filewd(-1), last_mtime(0) {}
+
+FileWatcher::~FileWatcher(){
+    if (fd != -1)
+        ::close(fd);
+}
+
+FileWatcher::FileWatcher(const FileWatcher& src) : listener(src.listener) {} // private copy constructor does nothing
+
+void FileWatcher::setup(){
+    if (setup_inotify())
+        return;
+    struct stat filestat;
+    if (stat(filename.c_str(), &filestat) == 0)
+        last_mtime = filestat.st_mtime;
+}
+
+void* FileWatcher::main(){
+    if (fd != -1)
+        watch_inotify();
+    else
+        watch_mtime();
+    return NULL;
+}
+
+void FileWatcher::stop(){ stop_flag = true; }
+
+#ifdef __linux__
+
+static const uint32_t DIRMASK = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM;
+static const uint32_t FILEMASK = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF;
+
+// returns false if inotify could not be set up
+bool FileWatcher::setup_inotify(){
+    // the directory is watched to catch the file being replaced, the file
+    // itself to catch writes through a symbolic link
+    string dirname(".");
+    basename = filename;
+    size_t slash = filename.rfind('/');
+    if (slash != string::npos) {
+        dirname = (slash == 0) ? string("/") : filename.substr(0, slash);
+        basename = filename.substr(slash + 1);
+    }
+
+    if ((fd = inotify_init()) == -1) {
+        cwarning << "Could not inotify_init(), polling \'" << filename << "\' instead: " << strerror(errno) << endl;
+        return false;
+    }
+    if ((dirwd = inotify_add_watch(fd, dirname.c_str(), DIRMASK)) == -1) {
+        cwarning << "Could not inotify_add_watch() \'" << dirname << "\', polling \'" << filename << "\' instead: " << strerror(errno) << endl;
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    filewd = inotify_add_watch(fd, filename.c_str(), FILEMASK);
+    return true;
+}
+
+void FileWatcher::watch_inotify(){
+    char buff[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    while (!stop_flag) {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+
+        // once something changed, wait for the writer to settle down before
+        // telling the listener, so that a file being written isn't read half
+        // way through
+        int ready = poll(&pfd, 1, changed ? SETTLE_MSEC : POLL_MSEC);
+        if (ready == -1 && errno != EINTR) {
+            cerror << "Could not poll() inotify descriptor: " << strerror(errno) << endl;
+            return;
+        }
+        if (ready <= 0) {
+            if (changed) {
+                changed = false;
+                // the file may be a new one by now
+                filewd = inotify_add_watch(fd, filename.c_str(), FILEMASK);
+                ctrace << "\t(\'" << filename << "\' changed)" << endl;
+                listener.file_changed();
+            }
+            continue;
+        }
+
+        ssize_t len = read(fd, buff, sizeof(buff));
+        if (len <= 0)
+            continue;
+        for (char* p = buff; p < buff + len; ) {
+            struct inotify_event* event = reinterpret_cast<struct inotify_event*>(p);
+            if (event->wd == filewd && (event->mask & FILEMASK))
+                changed = true;
+            else if (event->wd == dirwd && event->len > 0 && basename == event->name)
+                changed = true;
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+#else
+
+bool FileWatcher::setup_inotify(){ return false; }
+
+void FileWatcher::watch_inotify(){}
+
+#endif
+
+void FileWatcher::watch_mtime(){
+    struct stat filestat;
+    while (!stop_flag) {
+        poll(NULL, 0, POLL_MSEC);
+        if (stat(filename.c_str(), &filestat) == 0 && filestat.st_mtime != last_mtime) {
+            last_mtime = filestat.st_mtime;
+            ctrace << "\t(\'" << filename << "\' changed)" << endl;
+            listener.file_changed();
+        }
+    }
+}
+
+// Listener nested class
+FileWatcher::Listener::~Listener(){}
@@ -0,0 +1,58 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+// stdl includes
+#include <string>
+
+// Project includes
+#include "Thread.h"
+
+// Watches a single file from its own thread and tells a listener whenever it
+// changes: modified in place, or replaced by rename() or delete-and-create.
+//
+// On Linux this uses inotify on both the file and its directory, so changes
+// are noticed within milliseconds without any system call on behalf of the
+// listener. Elsewhere, or if inotify is not available, the file's
+// modification time is polled every POLL_MSEC milliseconds.
+class FileWatcher : public Thread::Runnable {
+public:
+    // Listener nested class, implemented by whoever needs to know
+    class Listener {
+    public:
+        virtual ~Listener();
+        virtual void file_changed() = 0;
+    };
+
+    FileWatcher(const std::string& filename, Listener& listener);
+    ~FileWatcher();
+
+    // start watching, changes from then on are reported once main() runs
+    void setup();
+    void* main();
+    void stop();
+
+    // constants
+    static const int POLL_MSEC = 200;
+    static const int SETTLE_MSEC = 20;
+
+private:
+    FileWatcher(const FileWatcher& src);
+
+    bool setup_inotify();
+    void watch_inotify();
+    void watch_mtime();
+
+    std::string filename;
+    Listener& listener;
+    volatile bool stop_flag;
+
+    // inotify descriptor and watches, fd is -1 when polling instead
+    int fd;
+    int dirwd;
+    int filewd;
+    std::string basename;
+
+    time_t last_mtime;
+};
+
+#endif // FILE_WATCHER_H
@@ -0,0 +1,211 @@
+// libc includes
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Project includes
+#include "trace.h"
+#include "HostsFile.h"
+
+// usings
+using namespace std;
+
+static inline bool is_blank(char c){
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+HostsFile::HostsFile(const std::string& filename) throw (FileException)
+    : data(NULL), length(0), file_mtime(0) {
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw FileException(errno, string(TRACELINE("Could not open() \'") + filename + "\'").c_str());
+
+    struct stat filestat;
+    if (fstat(fd, &filestat) != 0) {
+        int saved = errno;
+        ::close(fd);
+        throw FileException(saved, string(TRACELINE("Could not fstat() \'") + filename + "\'").c_str());
+    }
+    length = filestat.st_size;
+    file_mtime = filestat.st_mtime;
+
+    // read, not mmap()ed: a file truncated or rewritten in place under a
+    // mapping makes the next scan die of SIGBUS. A file cut short after
+    // fstat() is taken as far as it goes
+    if (length > 0) {
+        data = new char[length];
+        size_t got = 0;
+        while (got < length) {
+            ssize_t n = ::read(fd, data + got, length - got);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n == -1) {
+                int saved = errno;
+                ::close(fd);
+                delete []data;
+                throw FileException(saved, string(TRACELINE("Could not read() \'") + filename + "\'").c_str());
+            }
+            if (n == 0)
+                break;
+            got += n;
+        }
+        length = got;
+    }
+    ::close(fd);
+}
+
+HostsFile::~HostsFile(){ delete []data; }
+
+HostsFile::HostsFile(const HostsFile& src){} // private copy constructor does nothing
+
+const char* HostsFile::begin() const { return data; }
+
+const char* HostsFile::end() const { return data + length; }
+
+size_t HostsFile::size() const { return length; }
+
+time_t HostsFile::mtime() const { return file_mtime; }
+
+std::vector<const char*> HostsFile::split(unsigned int n) const {
+    vector<const char*> starts(1, begin());
+    for (unsigned int i = 1; i < n; i++) {
+        const char* p = begin() + length / n * i;
+        if (p <= starts.back())
+            continue;
+        const char* eol = static_cast<const char*>(memchr(p - 1, '\n', end() - (p - 1)));
+        if (eol == NULL || eol + 1 == end())
+            break;
+        starts.push_back(eol + 1);
+    }
+    starts.push_back(end());
+    return starts;
+}
+
+// Finding where tokens start and end is the bulk of tokenizing. With SSE2
+// each 16 bytes are classified at once into a mask of their blanks, and the
+// token or the blanks end at its first set or clear bit.
+
+#ifdef __SSE2__
+static inline unsigned int blank_mask(const char* p){
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    // '\t' to '\r' except '\n', and ' '
+    __m128i control = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1)),
+                                     _mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1)));
+    control = _mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), control);
+    __m128i space = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    return _mm_movemask_epi8(_mm_or_si128(control, space));
+}
+#endif
+
+const char* HostsFile::skip_blanks(const char* p, const char* end){
+#ifdef __SSE2__
+    for (; p + 16 <= end; p += 16) {
+        unsigned int mask = ~blank_mask(p) & 0xFFFF;
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+    }
+#endif
+    while (p < end && is_blank(*p)) p++;
+    return p;
+}
+
+const char* HostsFile::skip_token(const char* p, const char* end){
+#ifdef __SSE2__
+    for (; p + 16 <= end; p += 16) {
+        unsigned int mask = blank_mask(p);
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+    }
+#endif
+    while (p < end && !is_blank(*p)) p++;
+    return p;
+}
+
+bool HostsFile::parse_address(const char* p, const char* end, struct in_addr& ip){
+    uint32_t address = 0;
+    for (int octet = 0; octet < 4; octet++) {
+        if (octet > 0) {
+            if (p == end || *p != '.')
+                return false;
+            p++;
+        }
+        const char* digits = p;
+        unsigned int value = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            value = value * 10 + (*p - '0');
+            if (value > 255)
+                return false;
+            p++;
+        }
+        if (p == digits || (p - digits > 1 && *digits == '0'))
+            return false;
+        address = (address << 8) | value;
+    }
+    if (p != end)
+        return false;
+    ip.s_addr = htonl(address);
+    return true;
+}
+
+// Tokenizer nested class
+
+HostsFile::Tokenizer::Tokenizer(const char* b, const char* e, unsigned int m)
+    : pos(b), end(e), maxaliases(m) {}
+
+bool HostsFile::Tokenizer::next(Record& record){
+    while (pos < end) {
+        const char* p = pos;
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (eol == NULL) eol = end;
+        pos = (eol < end) ? eol + 1 : end;
+
+        // the address, a # denotes a comment
+        p = skip_blanks(p, eol);
+        if (p == eol || *p == '#') continue;
+        const char* token = p;
+        p = skip_token(p, eol);
+        if (!parse_address(token, p, record.ip)) continue;
+
+        // the names, up to maxaliases of them
+        record.names.clear();
+        while (record.names.size() < maxaliases) {
+            p = skip_blanks(p, eol);
+            if (p == eol || *p == '#') break;
+            Span name;
+            name.ptr = p;
+            p = skip_token(p, eol);
+            name.len = p - name.ptr;
+            record.names.push_back(name);
+        }
+        if (!record.names.empty())
+            return true;
+    }
+    return false;
+}
+
+// FileException nested class
+
+HostsFile::FileException::FileException(const char* s)
+    : std::runtime_error(s), errno_number(0) {}
+
+HostsFile::FileException::FileException(int i, const char* s)
+    : std::runtime_error(s), errno_number(i) {}
+
+const char* HostsFile::FileException::what() const throw(){
+    static string s;
+    s.assign(std::runtime_error::what());
+
+    if (errno_number != 0){
+        s += ": ";
+        s.append(strerror(errno_number));
+    }
+    return s.c_str();
+}
+
+int HostsFile::FileException::what_errno() const throw(){ return errno_number; }
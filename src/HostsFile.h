@@ -0,0 +1,84 @@
+#ifndef HOSTS_FILE_H
+#define HOSTS_FILE_H
+
+// stdl includes
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+// libc includes
+#include <sys/types.h>
+#include <arpa/inet.h>
+
+// A hosts file read whole into memory the object owns. Lines are tokenized
+// in place, the names handed out point straight into that copy and stay
+// valid for as long as the HostsFile object lives, whatever happens to the
+// file on disk meanwhile.
+class HostsFile {
+public:
+    // HostsFile exception
+    class FileException : public std::runtime_error {
+    public:
+        FileException(int i, const char* s);
+        FileException(const char* s);
+        const char* what() const throw();
+        int what_errno() const throw();
+    private:
+        int errno_number;
+    };
+
+    // A name inside the file's copy, not null terminated
+    struct Span {
+        const char* ptr;
+        size_t len;
+    };
+
+    // One parsed line: an address followed by its names
+    struct Record {
+        struct in_addr ip;
+        std::vector<Span> names;
+    };
+
+    // Tokenizer over [begin, end), which should start at a line boundary.
+    // Lines are read as /etc/hosts(5) says: an IPv4 address in dotted
+    // decimal, then names up to the end of the line or a #. Blank lines,
+    // comments and lines that don't start with an address are skipped.
+    class Tokenizer {
+    public:
+        Tokenizer(const char* begin, const char* end, unsigned int maxaliases);
+        // parse the next valid line into record, false at end of input
+        bool next(Record& record);
+    private:
+        const char* pos;
+        const char* end;
+        unsigned int maxaliases;
+    };
+
+    HostsFile(const std::string& filename) throw (FileException);
+    ~HostsFile();
+
+    const char* begin() const;
+    const char* end() const;
+    size_t size() const;
+    time_t mtime() const;
+    // the starts of at most n chunks of about the same size, each at the
+    // beginning of a line, followed by end()
+    std::vector<const char*> split(unsigned int n) const;
+
+    // the first byte in [p, end) that is not blank, or that is, or end.
+    // Blanks are spaces, tabs, \r, \v and \f, but not newlines.
+    static const char* skip_blanks(const char* p, const char* end);
+    static const char* skip_token(const char* p, const char* end);
+    // the address in dotted decimal in [p, end), taking exactly what
+    // inet_pton() does: four decimal numbers up to 255 without leading zeros
+    static bool parse_address(const char* p, const char* end, struct in_addr& ip);
+
+private:
+    HostsFile(const HostsFile& src);
+
+    char* data;
+    size_t length;
+    time_t file_mtime;
+};
+
+#endif // HOSTS_FILE_H
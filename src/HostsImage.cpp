@@ -0,0 +1,431 @@
+// libc includes
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// stdl includes
+#include <fstream>
+#include <vector>
+
+// Project includes
+#include "trace.h"
+#include "helper.h"
+#include "HostsFile.h"
+#include "HostsImage.h"
+
+// usings
+using namespace std;
+
+const char HostsImage::MAGIC[8] = {'M', 'I', 'N', 'N', 'S', 'I', 'M', 'G'};
+
+static const uint32_t BYTEORDER = 0x01020304;
+
+static inline size_t align8(size_t n){ return (n + 7) & ~(size_t) 7; }
+
+// where each array starts, from the counts in a header
+struct Layout {
+    size_t slots, entries, addrs, rslots, rentries, rnames, wild, filter, pool, end;
+};
+
+static Layout layout_of(size_t header, size_t nslots, size_t nentries, size_t entrysize,
+                        size_t naddrs, size_t nrslots, size_t nrentries, size_t rentrysize,
+                        size_t nrnames, size_t nwildcards, size_t filterbytes, size_t poolsize){
+    Layout l;
+    l.slots = align8(header);
+    l.entries = align8(l.slots + nslots * sizeof(uint32_t));
+    l.addrs = align8(l.entries + nentries * entrysize);
+    l.rslots = align8(l.addrs + naddrs * sizeof(struct in_addr));
+    l.rentries = align8(l.rslots + nrslots * sizeof(uint32_t));
+    l.rnames = align8(l.rentries + nrentries * rentrysize);
+    l.wild = align8(l.rnames + nrnames * sizeof(uint32_t));
+    l.filter = align8(l.wild + nwildcards * sizeof(uint32_t));
+    l.pool = align8(l.filter + filterbytes);
+    l.end = l.pool + poolsize;
+    return l;
+}
+
+// an address of a name being compiled, chained to the name's previous one,
+// or, for the reverse table, a name of an address
+struct Chain {
+    struct in_addr ip;
+    uint32_t next;
+};
+
+struct NameChain {
+    uint32_t entry;
+    uint32_t next;
+};
+
+HostsImage::HostsImage(const std::string& filename) throw (ImageException)
+    : data(NULL), length(0), bloom(NULL) {
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw ImageException(string(TRACELINE("Could not open() \'") + filename + "\': " + strerror(errno)).c_str());
+    struct stat filestat;
+    if (fstat(fd, &filestat) != 0 || (size_t) filestat.st_size < sizeof(Header)) {
+        ::close(fd);
+        throw ImageException(string(TRACELINE("Truncated image \'") + filename + "\'").c_str());
+    }
+    length = filestat.st_size;
+    void* mapped = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+        throw ImageException(string(TRACELINE("Could not mmap() \'") + filename + "\': " + strerror(errno)).c_str());
+    data = static_cast<const char*>(mapped);
+
+    // check everything before trusting any of it
+    const Header* header = reinterpret_cast<const Header*>(data);
+    const char* problem = NULL;
+    Layout l = layout_of(sizeof(Header), header->nslots, header->nentries, sizeof(Entry),
+                         header->naddrs, header->nrslots, header->nrentries, sizeof(Reverse),
+                         header->nrnames, header->nwildcards, (size_t) header->filterblocks * 64, header->poolsize);
+    if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0)
+        problem = "not an image";
+    else if (header->version != VERSION)
+        problem = "unknown version";
+    else if (header->byteorder != BYTEORDER)
+        problem = "compiled on a machine of different byte order";
+    else if (header->nslots == 0 || (header->nslots & (header->nslots - 1)) != 0 ||
+             header->nentries >= header->nslots)
+        problem = "bad hash table size";
+    else if (header->nrslots == 0 || (header->nrslots & (header->nrslots - 1)) != 0 ||
+             header->nrentries >= header->nrslots)
+        problem = "bad reverse hash table size";
+    else if (l.end != length)
+        problem = "bad size";
+    else if (checksum(data + l.slots, data + l.end) != header->checksum)
+        problem = "bad checksum";
+    if (problem != NULL) {
+        munmap(const_cast<char*>(data), length);
+        throw ImageException(string(TRACELINE("Could not load image \'") + filename + "\': " + problem).c_str());
+    }
+
+    slots = reinterpret_cast<const uint32_t*>(data + l.slots);
+    entries = reinterpret_cast<const Entry*>(data + l.entries);
+    addrs = reinterpret_cast<const struct in_addr*>(data + l.addrs);
+    rslots = reinterpret_cast<const uint32_t*>(data + l.rslots);
+    rentries = reinterpret_cast<const Reverse*>(data + l.rentries);
+    rnames = reinterpret_cast<const uint32_t*>(data + l.rnames);
+    wild = reinterpret_cast<const uint32_t*>(data + l.wild);
+    pool = data + l.pool;
+    mask = header->nslots - 1;
+    rmask = header->nrslots - 1;
+    nentries = header->nentries;
+    bloom = new BloomFilter(reinterpret_cast<const uint32_t*>(data + l.filter), header->filterblocks);
+}
+
+HostsImage::~HostsImage(){
+    delete bloom;
+    if (data != NULL && munmap(const_cast<char*>(data), length) != 0)
+        cerror << "~HostsImage(): could not munmap() mapping at 0x" << hex << (void*) data << dec << endl;
+}
+
+HostsImage::HostsImage(const HostsImage& src){} // private copy constructor does nothing
+
+// every entry is bounds checked as it is used, an image with a good
+// checksum may still come from a broken compiler
+bool HostsImage::lookup(const std::string& name, uint32_t hash, const struct in_addr*& ips, uint32_t& naddrs) const {
+    const Header* header = reinterpret_cast<const Header*>(data);
+    for (uint32_t pos = hash & mask; slots[pos] != 0; pos = (pos + 1) & mask) {
+        if (slots[pos] > nentries)
+            return false;
+        const Entry& entry = entries[slots[pos] - 1];
+        if (entry.hash != hash || entry.len != name.size())
+            continue;
+        if (entry.name > header->poolsize || entry.len > header->poolsize - entry.name ||
+            entry.addr > header->naddrs || entry.naddrs > header->naddrs - entry.addr)
+            return false;
+        if (memcmp(pool + entry.name, name.data(), entry.len) == 0) {
+            ips = addrs + entry.addr;
+            naddrs = entry.naddrs;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HostsImage::lookup_address(struct in_addr address, std::vector<std::string>& names) const {
+    const Header* header = reinterpret_cast<const Header*>(data);
+    for (uint32_t pos = address_hash(address) & rmask; rslots[pos] != 0; pos = (pos + 1) & rmask) {
+        if (rslots[pos] > header->nrentries)
+            return false;
+        const Reverse& reverse = rentries[rslots[pos] - 1];
+        if (reverse.address.s_addr != address.s_addr)
+            continue;
+        if (reverse.name > header->nrnames || reverse.nnames > header->nrnames - reverse.name)
+            return false;
+        for (uint32_t i = reverse.name; i < reverse.name + reverse.nnames; i++) {
+            if (rnames[i] >= nentries)
+                return false;
+            const Entry& entry = entries[rnames[i]];
+            if (entry.name > header->poolsize || entry.len > header->poolsize - entry.name)
+                return false;
+            names.push_back(string(pool + entry.name, entry.len));
+        }
+        return true;
+    }
+    return false;
+}
+
+size_t HostsImage::wildcard_count() const {
+    return reinterpret_cast<const Header*>(data)->nwildcards;
+}
+
+bool HostsImage::wildcard(size_t i, const char*& name, size_t& len, const struct in_addr*& ips, uint32_t& naddrs) const {
+    const Header* header = reinterpret_cast<const Header*>(data);
+    if (i >= header->nwildcards || wild[i] >= nentries)
+        return false;
+    const Entry& entry = entries[wild[i]];
+    if (entry.name > header->poolsize || entry.len > header->poolsize - entry.name ||
+        entry.addr > header->naddrs || entry.naddrs > header->naddrs - entry.addr)
+        return false;
+    name = pool + entry.name;
+    len = entry.len;
+    ips = addrs + entry.addr;
+    naddrs = entry.naddrs;
+    return true;
+}
+
+const BloomFilter& HostsImage::filter() const { return *bloom; }
+
+size_t HostsImage::size() const { return nentries; }
+
+bool HostsImage::is_image(const std::string& filename){
+    char magic[sizeof(MAGIC)];
+    ifstream file(filename.c_str(), ios::in | ios::binary);
+    return file.read(magic, sizeof(magic)) && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+uint32_t HostsImage::address_hash(struct in_addr address){
+    uint32_t h = address.s_addr * 0x9E3779B1u;
+    return h ^ (h >> 16);
+}
+
+// FNV-1a, a word at a time
+uint32_t HostsImage::checksum(const char* begin, const char* end){
+    uint32_t h = 2166136261u;
+    const char* p = begin;
+    for (; p + 4 <= end; p += 4) {
+        uint32_t word;
+        memcpy(&word, p, 4);
+        h = (h ^ word) * 16777619u;
+    }
+    for (; p < end; p++)
+        h = (h ^ (unsigned char) *p) * 16777619u;
+    return h;
+}
+
+// builds the same table DnsResolver's index would, addresses are chained
+// while parsing and laid out in a row per entry at the end
+void HostsImage::compile(const std::string& hostsfile, const std::string& imagefile,
+                         unsigned int maxaliases, unsigned int maxialiases) throw (ImageException){
+    const uint32_t NONE = 0xFFFFFFFF;
+
+    HostsFile* hosts;
+    try {
+        hosts = new HostsFile(hostsfile);
+    } catch (HostsFile::FileException& e) {
+        throw ImageException(e.what());
+    }
+
+    vector<uint32_t> table(16, 0);
+    vector<Entry> built;
+    vector<uint32_t> heads; // per entry, into chains
+    vector<Chain> chains;
+    vector<char> names;
+    // the same for addresses, whose chains are of entries
+    vector<uint32_t> rtable(16, 0);
+    vector<Reverse> rbuilt;
+    vector<uint32_t> rheads;
+    vector<NameChain> rchains;
+    vector<uint32_t> wildcards;
+
+    HostsFile::Tokenizer tokenizer(hosts->begin(), hosts->end(), maxaliases);
+    HostsFile::Record record;
+    while (tokenizer.next(record)) {
+        for (size_t i = 0; i < record.names.size(); i++) {
+            const HostsFile::Span& name = record.names[i];
+            uint32_t hash = hash_helper(name.ptr, name.len);
+            size_t mask = table.size() - 1;
+            size_t pos = hash & mask;
+            for (; table[pos] != 0; pos = (pos + 1) & mask) {
+                const Entry& entry = built[table[pos] - 1];
+                if (entry.hash == hash && entry.len == name.len && nocase_equal_helper(&names[entry.name], name.ptr, name.len))
+                    break;
+            }
+            if (table[pos] == 0) {
+                Entry entry;
+                entry.hash = hash;
+                entry.name = names.size();
+                entry.len = name.len;
+                entry.addr = 0;
+                entry.naddrs = 0;
+                // stored in lowercase, like the names looked up
+                names.resize(entry.name + name.len);
+                lowercase_helper(&names[entry.name], name.ptr, name.len);
+                built.push_back(entry);
+                heads.push_back(NONE);
+                table[pos] = built.size();
+                if (name.len > 2 && name.ptr[0] == '*' && name.ptr[1] == '.')
+                    wildcards.push_back(built.size() - 1);
+            }
+            uint32_t e = table[pos] - 1;
+
+            // keep the table at most half full
+            if (built.size() * 2 > table.size()) {
+                vector<uint32_t> old;
+                old.swap(table);
+                table.assign(old.size() * 2, 0);
+                mask = table.size() - 1;
+                for (size_t j = 0; j < old.size(); j++) {
+                    if (old[j] == 0) continue;
+                    size_t p = built[old[j] - 1].hash & mask;
+                    while (table[p] != 0)
+                        p = (p + 1) & mask;
+                    table[p] = old[j];
+                }
+            }
+
+            // and the name to the address's
+            size_t rmask = rtable.size() - 1;
+            size_t rpos = address_hash(record.ip) & rmask;
+            while (rtable[rpos] != 0 && rbuilt[rtable[rpos] - 1].address.s_addr != record.ip.s_addr)
+                rpos = (rpos + 1) & rmask;
+            if (rtable[rpos] == 0) {
+                Reverse reverse;
+                reverse.address = record.ip;
+                reverse.name = 0;
+                reverse.nnames = 0;
+                rbuilt.push_back(reverse);
+                rheads.push_back(NONE);
+                rtable[rpos] = rbuilt.size();
+            }
+            uint32_t r = rtable[rpos] - 1;
+            if (rbuilt.size() * 2 > rtable.size()) {
+                vector<uint32_t> old;
+                old.swap(rtable);
+                rtable.assign(old.size() * 2, 0);
+                rmask = rtable.size() - 1;
+                for (size_t j = 0; j < old.size(); j++) {
+                    if (old[j] == 0) continue;
+                    size_t p = address_hash(rbuilt[old[j] - 1].address) & rmask;
+                    while (rtable[p] != 0)
+                        p = (p + 1) & rmask;
+                    rtable[p] = old[j];
+                }
+            }
+            bool named = rbuilt[r].nnames >= maxaliases;
+            for (uint32_t c = rheads[r]; c != NONE && !named; c = rchains[c].next)
+                named = rchains[c].entry == e;
+            if (!named) {
+                NameChain chain;
+                chain.entry = e;
+                chain.next = rheads[r];
+                rchains.push_back(chain);
+                rheads[r] = rchains.size() - 1;
+                rbuilt[r].nnames++;
+            }
+
+            // append ip to the name's chain, unless it's already there
+            Entry& entry = built[e];
+            if (entry.naddrs >= maxialiases)
+                continue;
+            bool dup = false;
+            for (uint32_t c = heads[e]; c != NONE && !dup; c = chains[c].next)
+                dup = chains[c].ip.s_addr == record.ip.s_addr;
+            if (dup)
+                continue;
+            Chain chain;
+            chain.ip = record.ip;
+            chain.next = heads[e];
+            chains.push_back(chain);
+            heads[e] = chains.size() - 1;
+            entry.naddrs++;
+        }
+    }
+    delete hosts;
+
+    BloomFilter filter(built.size());
+    for (size_t e = 0; e < built.size(); e++)
+        filter.add(built[e].hash);
+
+    if (names.size() > NONE || chains.size() > NONE || rchains.size() > NONE)
+        throw ImageException(TRACELINE("Hosts file too big for an image"));
+    Layout l = layout_of(sizeof(Header), table.size(), built.size(), sizeof(Entry),
+                         chains.size(), rtable.size(), rbuilt.size(), sizeof(Reverse),
+                         rchains.size(), wildcards.size(), filter.size(), names.size());
+    vector<char> image(l.end, 0);
+
+    // addresses in file order, each entry's in a row
+    struct in_addr* ips = reinterpret_cast<struct in_addr*>(&image[0] + l.addrs);
+    uint32_t next = 0;
+    for (size_t e = 0; e < built.size(); e++) {
+        built[e].addr = next;
+        next += built[e].naddrs;
+        uint32_t i = next;
+        for (uint32_t c = heads[e]; c != NONE; c = chains[c].next)
+            ips[--i] = chains[c].ip;
+    }
+    uint32_t* rnamed = reinterpret_cast<uint32_t*>(&image[0] + l.rnames);
+    next = 0;
+    for (size_t r = 0; r < rbuilt.size(); r++) {
+        rbuilt[r].name = next;
+        next += rbuilt[r].nnames;
+        uint32_t i = next;
+        for (uint32_t c = rheads[r]; c != NONE; c = rchains[c].next)
+            rnamed[--i] = rchains[c].entry;
+    }
+    memcpy(&image[0] + l.rslots, &rtable[0], rtable.size() * sizeof(uint32_t));
+    if (!rbuilt.empty())
+        memcpy(&image[0] + l.rentries, &rbuilt[0], rbuilt.size() * sizeof(Reverse));
+    if (!wildcards.empty())
+        memcpy(&image[0] + l.wild, &wildcards[0], wildcards.size() * sizeof(uint32_t));
+    if (!table.empty())
+        memcpy(&image[0] + l.slots, &table[0], table.size() * sizeof(uint32_t));
+    if (!built.empty())
+        memcpy(&image[0] + l.entries, &built[0], built.size() * sizeof(Entry));
+    memcpy(&image[0] + l.filter, filter.data(), filter.size());
+    if (!names.empty())
+        memcpy(&image[0] + l.pool, &names[0], names.size());
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byteorder = BYTEORDER;
+    header.nslots = table.size();
+    header.nentries = built.size();
+    header.naddrs = chains.size();
+    header.nrslots = rtable.size();
+    header.nrentries = rbuilt.size();
+    header.nrnames = rchains.size();
+    header.nwildcards = wildcards.size();
+    header.filterblocks = filter.block_count();
+    header.poolsize = names.size();
+    header.checksum = checksum(&image[0] + l.slots, &image[0] + l.end);
+    memcpy(&image[0], &header, sizeof(header));
+
+    // readers only ever see a complete image
+    string temp = imagefile + ".tmp";
+    ofstream out(temp.c_str(), ios::out | ios::binary | ios::trunc);
+    out.write(&image[0], image.size());
+    out.close();
+    if (out.fail()) {
+        unlink(temp.c_str());
+        throw ImageException(string(TRACELINE("Could not write \'") + temp + "\'").c_str());
+    }
+    if (rename(temp.c_str(), imagefile.c_str()) != 0) {
+        unlink(temp.c_str());
+        throw ImageException(string(TRACELINE("Could not rename() \'") + temp + "\': " + strerror(errno)).c_str());
+    }
+}
+
+// ImageException nested class
+
+HostsImage::ImageException::ImageException(const char* s)
+    : std::runtime_error(s) {}
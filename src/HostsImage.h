@@ -0,0 +1,126 @@
+#ifndef HOSTS_IMAGE_H
+#define HOSTS_IMAGE_H
+
+// stdl includes
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+// libc includes
+#include <sys/types.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+// Project includes
+#include "BloomFilter.h"
+
+// A hosts file compiled by minns-compile into a binary image, mapped
+// read-only and used in place: nothing is parsed or copied when it is
+// loaded, and processes mapping the same image share its pages.
+//
+// An image is a header followed by nine arrays, each starting at a multiple
+// of 8 bytes:
+//
+//   slots    uint32_t[nslots], an open-addressed (linear probing) hash table
+//            of entry indexes plus one, 0 marks an empty slot
+//   entries  Entry[nentries], a name's hash, its place in the pool and its
+//            addresses
+//   addrs    struct in_addr[naddrs], the addresses of each entry in a row
+//   rslots   uint32_t[nrslots], the same kind of table for addresses
+//   rentries Reverse[nrentries], an address and its names
+//   rnames   uint32_t[nrnames], the entries naming each address in a row
+//   wild     uint32_t[nwildcards], the entries of wildcard names (*.example)
+//   filter   uint32_t[], a BloomFilter of the hashes of all names
+//   pool     the names, one after the other, not null terminated
+//
+// Everything is in the byte order of the machine that compiled the image.
+// The checksum covers all of it but the header, and is checked, along with
+// every offset, when the image is loaded.
+class HostsImage {
+public:
+    // HostsImage exception
+    class ImageException : public std::runtime_error {
+    public:
+        ImageException(const char* s);
+    };
+
+    HostsImage(const std::string& filename) throw (ImageException);
+    ~HostsImage();
+
+    // compile hostsfile into imagefile, which is replaced with rename() once
+    // it is complete
+    static void compile(const std::string& hostsfile, const std::string& imagefile,
+                        unsigned int maxaliases, unsigned int maxialiases) throw (ImageException);
+    // true if filename starts like an image
+    static bool is_image(const std::string& filename);
+
+    // point ips at the naddrs addresses of name, false if it isn't there.
+    // Names are stored in lowercase, name must be too.
+    bool lookup(const std::string& name, uint32_t hash, const struct in_addr*& ips, uint32_t& naddrs) const;
+    // append the names of address, false if it isn't there
+    bool lookup_address(struct in_addr address, std::vector<std::string>& names) const;
+    // the i-th wildcard name and its addresses, false if the image is broken
+    size_t wildcard_count() const;
+    bool wildcard(size_t i, const char*& name, size_t& len, const struct in_addr*& ips, uint32_t& naddrs) const;
+
+    const BloomFilter& filter() const;
+    size_t size() const;
+
+    // constants
+    static const char MAGIC[8];
+    static const uint32_t VERSION = 4;
+
+private:
+    HostsImage(const HostsImage& src);
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteorder;
+        uint32_t nslots;
+        uint32_t nentries;
+        uint32_t naddrs;
+        uint32_t nrslots;
+        uint32_t nrentries;
+        uint32_t nrnames;
+        uint32_t nwildcards;
+        uint32_t filterblocks;
+        uint32_t poolsize;
+        uint32_t checksum;
+    };
+
+    struct Entry {
+        uint32_t hash;
+        uint32_t name;
+        uint32_t len;
+        uint32_t addr;
+        uint32_t naddrs;
+    };
+
+    struct Reverse {
+        struct in_addr address;
+        uint32_t name;
+        uint32_t nnames;
+    };
+
+    static uint32_t checksum(const char* begin, const char* end);
+    static uint32_t address_hash(struct in_addr address);
+
+    const char* data;
+    size_t length;
+
+    const uint32_t* slots;
+    const Entry* entries;
+    const struct in_addr* addrs;
+    const uint32_t* rslots;
+    const Reverse* rentries;
+    const uint32_t* rnames;
+    const uint32_t* wild;
+    const char* pool;
+    uint32_t mask;
+    uint32_t rmask;
+    uint32_t nentries;
+    BloomFilter* bloom;
+};
+
+#endif // HOSTS_IMAGE_H
@@ -0,0 +1,127 @@
+// stdl includes
+#include <algorithm>
+
+// Project includes
+#include "trace.h"
+#include "PerfectHash.h"
+
+// usings
+using namespace std;
+
+// the splitmix64 finalizer
+static inline uint64_t mix(uint64_t h){
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+    return h;
+}
+
+// a number in [0, n) from the high bits of h, without a division
+static inline uint32_t range(uint64_t h, uint32_t n){
+    return (uint32_t) (((h >> 32) * n) >> 32);
+}
+
+PerfectHash::PerfectHash(const std::vector<uint64_t>& keys) throw (BuildException)
+    : seed(0), nkeys(keys.size()) {
+    if (keys.size() >= 0xFFFFFFF0u)
+        throw BuildException(TRACELINE("Too many keys"));
+    nslots = nkeys + nkeys / 32 + 1;
+    for (unsigned int i = 0; i < SEEDS; i++, seed = mix(seed + 0x9E3779B97F4A7C15ULL))
+        if (build(keys))
+            return;
+    throw BuildException(TRACELINE("Could not find pilots for all buckets"));
+}
+
+PerfectHash::PerfectHash(const PerfectHash& src){} // private copy constructor does nothing
+
+uint32_t PerfectHash::bucket_of(uint64_t key) const {
+    return range(mix(key ^ seed), pilots.size());
+}
+
+uint32_t PerfectHash::slot_of(uint64_t key, uint16_t pilot) const {
+    return range(mix(key ^ seed ^ ((uint64_t) (pilot + 1) * 0x9E3779B97F4A7C15ULL)), nslots);
+}
+
+uint32_t PerfectHash::lookup(uint64_t key) const {
+    uint32_t slot = slot_of(key, pilots[bucket_of(key)]);
+    return (slot < nkeys) ? slot : remap[slot - nkeys];
+}
+
+size_t PerfectHash::size() const {
+    return pilots.size() * sizeof(uint16_t) + remap.size() * sizeof(uint32_t);
+}
+
+// place the biggest buckets first, while most slots are still free
+bool PerfectHash::build(const std::vector<uint64_t>& keys) throw (BuildException){
+    uint32_t nbuckets = nkeys / KEYS_PER_BUCKET + 1;
+    pilots.assign(nbuckets, 0);
+
+    // keys grouped by bucket, with a counting sort
+    vector<uint32_t> start(nbuckets + 1, 0);
+    for (size_t i = 0; i < keys.size(); i++)
+        start[bucket_of(keys[i]) + 1]++;
+    for (uint32_t b = 0; b < nbuckets; b++)
+        start[b + 1] += start[b];
+    vector<uint64_t> grouped(keys.size());
+    vector<uint32_t> fill(start.begin(), start.end() - 1);
+    for (size_t i = 0; i < keys.size(); i++)
+        grouped[fill[bucket_of(keys[i])]++] = keys[i];
+
+    // and buckets by decreasing size
+    uint32_t maxsize = 0;
+    for (uint32_t b = 0; b < nbuckets; b++)
+        maxsize = max(maxsize, start[b + 1] - start[b]);
+    vector<uint32_t> order;
+    order.reserve(nbuckets);
+    for (uint32_t size = maxsize; size > 0; size--)
+        for (uint32_t b = 0; b < nbuckets; b++)
+            if (start[b + 1] - start[b] == size)
+                order.push_back(b);
+
+    vector<bool> taken(nslots, false);
+    vector<uint32_t> slots;
+    for (size_t o = 0; o < order.size(); o++) {
+        uint32_t b = order[o];
+        uint64_t* first = &grouped[start[b]];
+        uint64_t* last = &grouped[start[b + 1]];
+        sort(first, last);
+        if (adjacent_find(first, last) != last)
+            throw BuildException(TRACELINE("Duplicate keys"));
+
+        bool placed = false;
+        for (uint32_t pilot = 0; pilot <= 0xFFFF && !placed; pilot++) {
+            slots.clear();
+            placed = true;
+            for (uint64_t* key = first; key != last && placed; key++) {
+                uint32_t slot = slot_of(*key, pilot);
+                placed = !taken[slot] && find(slots.begin(), slots.end(), slot) == slots.end();
+                slots.push_back(slot);
+            }
+            if (placed) {
+                pilots[b] = pilot;
+                for (size_t i = 0; i < slots.size(); i++)
+                    taken[slots[i]] = true;
+            }
+        }
+        if (!placed)
+            return false;
+    }
+
+    // send keys that landed past nkeys to the holes below it, there are
+    // exactly as many of those
+    remap.assign(nslots - nkeys, 0);
+    uint32_t hole = 0;
+    for (uint32_t slot = nkeys; slot < nslots; slot++) {
+        if (!taken[slot]) continue;
+        while (taken[hole]) hole++;
+        remap[slot - nkeys] = hole++;
+    }
+    return true;
+}
+
+// BuildException nested class
+
+PerfectHash::BuildException::BuildException(const char* s)
+    : std::runtime_error(s) {}
@@ -0,0 +1,56 @@
+#ifndef PERFECT_HASH_H
+#define PERFECT_HASH_H
+
+// stdl includes
+#include <vector>
+#include <stdexcept>
+
+// libc includes
+#include <stdint.h>
+#include <stddef.h>
+
+// A minimal perfect hash over a fixed set of n distinct 64-bit keys: each
+// key maps to its own number in [0, n), with no probing. Keys not in the set
+// map to some number too, so callers must check what they find there.
+//
+// Hash and displace (as in CHD or PTHash): keys are split into buckets of
+// about KEYS_PER_BUCKET, and each bucket gets a 16-bit pilot, found by trial
+// at build time, that sends all of its keys to free slots. Slots are a few
+// percent more than keys, which keeps the trials short; the few keys landing
+// past n are sent on to the holes below n by a small remap table. All this
+// costs about 5 bits per key.
+class PerfectHash {
+public:
+    // PerfectHash exception
+    class BuildException : public std::runtime_error {
+    public:
+        BuildException(const char* s);
+    };
+
+    // fails only for duplicate keys, or with very bad luck
+    PerfectHash(const std::vector<uint64_t>& keys) throw (BuildException);
+
+    uint32_t lookup(uint64_t key) const;
+    // in bytes
+    size_t size() const;
+
+    // constants
+    static const unsigned int KEYS_PER_BUCKET = 4;
+    static const unsigned int SEEDS = 8;
+
+private:
+    PerfectHash(const PerfectHash& src);
+
+    bool build(const std::vector<uint64_t>& keys) throw (BuildException);
+    uint32_t bucket_of(uint64_t key) const;
+    uint32_t slot_of(uint64_t key, uint16_t pilot) const;
+
+    uint64_t seed;
+    uint32_t nkeys;
+    uint32_t nslots;
+    std::vector<uint16_t> pilots;
+    // slot - nkeys to a free slot below nkeys
+    std::vector<uint32_t> remap;
+};
+
+#endif // PERFECT_HASH_H
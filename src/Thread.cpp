@@ -2,6 +2,8 @@
 #include <string.h>
 #include <pthread.h>
 #include <signal.h>
+#include <sched.h>
+#include <time.h>
 
 // Project includes
 #include "trace.h"
@@ -102,6 +104,127 @@ void Thread::Semaphore::post() throw (ThreadException){
         throw ThreadException(errno, TRACELINE("Could not sem_post()"));
 }
 
+bool Thread::Semaphore::timed_wait(unsigned int seconds) throw (ThreadException){
+    struct timespec deadline;
+    if (clock_gettime(CLOCK_REALTIME, &deadline) != 0)
+        throw ThreadException(errno, TRACELINE("Could not clock_gettime()"));
+    deadline.tv_sec += seconds;
+    int sem_retval;
+    while (((sem_retval = sem_timedwait(&sem, &deadline)) == -1) && (errno == EINTR))
+        continue;       /* Restart if interrupted by some handler */
+    if (sem_retval == 0)
+        return true;
+    if (errno == ETIMEDOUT)
+        return false;
+    throw ThreadException(errno, TRACELINE("Could not sem_timedwait()"));
+}
+
+
+// each thread sticks to the slot it was first given
+unsigned int Thread::slot(){
+    static volatile unsigned int next = 0;
+    static __thread int mine = -1;
+    if (mine == -1)
+        mine = __sync_fetch_and_add(&next, 1) % SLOTS;
+    return mine;
+}
+
+// Counter nested class
+
+Thread::Counter::Counter() throw (){
+    for (unsigned int i = 0; i < SLOTS; i++)
+        slots[i].count = 0;
+}
+
+Thread::Counter::Counter(const Counter& src){} // private copy constructor does nothing
+
+void Thread::Counter::add(long n) throw (){
+    __sync_fetch_and_add(&slots[slot()].count, n);
+}
+
+long Thread::Counter::value() const throw (){
+    long total = 0;
+    for (unsigned int i = 0; i < SLOTS; i++)
+        total += slots[i].count;
+    return total;
+}
+
+// Rcu nested class
+
+Thread::Rcu::Rcu() throw (ThreadException)
+    : retired_head(NULL), retired_count(0), epoch(0) {
+    for (unsigned int i = 0; i < SLOTS; i++)
+        slots[i].readers[0] = slots[i].readers[1] = 0;
+}
+
+// nobody can be reading anymore
+Thread::Rcu::~Rcu(){
+    while (retired_head != NULL) {
+        Retired* object = retired_head;
+        retired_head = object->next_retired;
+        delete object;
+    }
+}
+
+Thread::Rcu::Rcu(const Rcu& src){} // private copy constructor does nothing
+
+// count ourselves in the current epoch. If a writer flipped the epoch in the
+// meantime, move over to the new one so that it doesn't wait for us
+unsigned int Thread::Rcu::read_lock() throw (){
+    Slot& s = slots[slot()];
+    while (true) {
+        unsigned int e = epoch & 1;
+        __sync_fetch_and_add(&s.readers[e], 1);
+        if ((epoch & 1) == e)
+            return e;
+        __sync_fetch_and_sub(&s.readers[e], 1);
+    }
+}
+
+void Thread::Rcu::read_unlock(unsigned int e) throw (){
+    __sync_fetch_and_sub(&slots[slot()].readers[e], 1);
+}
+
+// flip the epoch, new readers count themselves in the other half, then wait
+// for the old half to drain
+void Thread::Rcu::synchronize() throw (ThreadException){
+    writer.lock();
+    __sync_synchronize();
+    unsigned int old = __sync_fetch_and_add(&epoch, 1) & 1;
+    for (unsigned int i = 0; i < SLOTS; i++)
+        while (slots[i].readers[old] != 0)
+            sched_yield();
+    __sync_synchronize();
+    writer.unlock();
+}
+
+// lock-free push onto the list of retired objects
+void Thread::Rcu::retire(Retired* object) throw (){
+    Retired* head;
+    do {
+        head = retired_head;
+        object->next_retired = head;
+    } while (!__sync_bool_compare_and_swap(&retired_head, head, object));
+    __sync_fetch_and_add(&retired_count, 1);
+}
+
+size_t Thread::Rcu::retired() const throw (){ return retired_count; }
+
+// take everything retired so far, wait until no reader can see it and delete it
+void Thread::Rcu::collect() throw (ThreadException){
+    Retired* object = __sync_lock_test_and_set(&retired_head, (Retired*) NULL);
+    synchronize();
+    while (object != NULL) {
+        Retired* next = object->next_retired;
+        delete object;
+        __sync_fetch_and_sub(&retired_count, 1);
+        object = next;
+    }
+}
+
+// Retired nested nested class
+Thread::Rcu::Retired::Retired() : next_retired(NULL) {}
+Thread::Rcu::Retired::~Retired() {}
 
 // Runnable "abstract" nested class
 Thread::Runnable::Runnable() {}
@@ -64,11 +64,85 @@ public:
         ~Semaphore();
         void wait() throw (ThreadException);
         void post() throw (ThreadException);
+        // false if nobody posted within seconds
+        bool timed_wait(unsigned int seconds) throw (ThreadException);
     private:
         Semaphore(const Semaphore& src);
         sem_t sem;
     };
 
+    // per-thread structures are spread over SLOTS slots, slot() returns the
+    // calling thread's one
+    static const unsigned int SLOTS = 64;
+    static unsigned int slot();
+
+    // Rcu nested class, read-copy-update style grace periods. Readers bracket
+    // their accesses to shared data with read_lock()/read_unlock(), which
+    // never block. A writer publishes a new version with an atomic pointer
+    // store, then calls synchronize(), which returns once every reader that
+    // could still see the old version is done with it.
+    //
+    // Objects that readers may still see can also be handed to retire(), then
+    // a later collect() waits for a grace period and deletes them all. Neither
+    // synchronize() nor collect() may be called from within a read section.
+    class Rcu {
+    public:
+        // Retired nested nested class, base for objects freed by collect()
+        class Retired {
+        public:
+            Retired();
+            virtual ~Retired();
+        private:
+            friend class Rcu;
+            Retired* next_retired;
+        };
+
+        Rcu() throw(ThreadException);
+        ~Rcu();
+        unsigned int read_lock() throw ();
+        void read_unlock(unsigned int epoch) throw ();
+        void synchronize() throw (ThreadException);
+
+        void retire(Retired* object) throw ();
+        size_t retired() const throw ();
+        void collect() throw (ThreadException);
+    private:
+        Rcu(const Rcu& src);
+
+        Retired* volatile retired_head;
+        volatile size_t retired_count;
+
+        // readers are spread over padded counter pairs, one pair per slot, so
+        // that threads don't fight over a single cache line
+        struct Slot {
+            volatile long readers[2];
+            char padding[64 - 2 * sizeof(long)];
+        };
+
+        Slot slots[SLOTS];
+        volatile unsigned int epoch;
+        Mutex writer;
+    };
+
+    // Counter nested class, a statistics counter that any number of threads
+    // can bump at once without sharing a cache line. Reading it sums all
+    // slots, so it is only exact while nobody is adding.
+    class Counter {
+    public:
+        Counter() throw ();
+        void add(long n = 1) throw ();
+        long value() const throw ();
+    private:
+        Counter(const Counter& src);
+
+        struct Slot {
+            volatile long count;
+            char padding[64 - sizeof(long)];
+        };
+
+        Slot slots[SLOTS];
+    };
+
     // pthread wrappers
     void run() throw (ThreadException);
     void join(void* retval) throw (ThreadException);
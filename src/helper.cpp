@@ -5,6 +5,9 @@
 #include <limits.h>
 #include <errno.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 // stdlib includes
 #include <iostream>
@@ -124,6 +127,103 @@ sighandler_t signal_helper(int signo, sighandler_t func) throw (std::runtime_err
     return(oact.sa_handler);
 }
 
+// Domain names are hashed a word at a time, ignoring case, so that a name
+// can be hashed as found in the hosts file or after lowercase_helper() alike.
 
+static inline uint64_t lower_word(uint64_t w)
+{
+    // per byte: the high bit of gt_z is set above 'Z', that of ge_a from 'A'
+    // up, for bytes under 0x80 only
+    uint64_t low = w & 0x7F7F7F7F7F7F7F7FULL;
+    uint64_t gt_z = low + 0x2525252525252525ULL;
+    uint64_t ge_a = low + 0x3F3F3F3F3F3F3F3FULL;
+    uint64_t upper = (ge_a ^ gt_z) & ~w & 0x8080808080808080ULL;
+    return w | (upper >> 2);
+}
 
+static inline uint64_t hash_word(uint64_t h, uint64_t w)
+{
+    h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 29);
+}
+
+// the splitmix64 finalizer, so that every bit counts
+static inline uint64_t hash_finish(uint64_t h)
+{
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+    return h;
+}
+
+uint64_t hash64_helper(const char* s, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL ^ len;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, s + i, 8);
+        h = hash_word(h, lower_word(w));
+    }
+    if (i < len) {
+        uint64_t w = 0;
+        memcpy(&w, s + i, len - i);
+        h = (h ^ lower_word(w)) * 0x9E3779B97F4A7C15ULL;
+    }
+    return hash_finish(h);
+}
 
+uint32_t hash_helper(const char* s, size_t len)
+{
+    return (uint32_t) hash64_helper(s, len);
+}
+
+// 16 bytes at a time where SSE2 is available, then 8, hashing each word as
+// hash64_helper() would once it is lowercased. Bytes from 0x80 up are
+// negative to the signed compares, so they are never taken for capitals.
+uint64_t lowercase_helper(char* dst, const char* src, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL ^ len;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i before_a = _mm_set1_epi8('A' - 1);
+    const __m128i after_z = _mm_set1_epi8('Z' + 1);
+    const __m128i bit = _mm_set1_epi8(0x20);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, before_a), _mm_cmplt_epi8(v, after_z));
+        v = _mm_or_si128(v, _mm_and_si128(upper, bit));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), v);
+        uint64_t w[2];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(w), v);
+        h = hash_word(hash_word(h, w[0]), w[1]);
+    }
+#endif
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, src + i, 8);
+        w = lower_word(w);
+        memcpy(dst + i, &w, 8);
+        h = hash_word(h, w);
+    }
+    if (i < len) {
+        uint64_t w = 0;
+        memcpy(&w, src + i, len - i);
+        w = lower_word(w);
+        memcpy(dst + i, &w, len - i);
+        h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+    }
+    return hash_finish(h);
+}
+
+bool nocase_equal_helper(const char* a, const char* b, size_t len)
+{
+    if (memcmp(a, b, len) == 0)
+        return true;
+    for (size_t i = 0; i < len; i++)
+        if (tolower((unsigned char) a[i]) != tolower((unsigned char) b[i]))
+            return false;
+    return true;
+}
@@ -4,6 +4,8 @@
 // libc includes
 #include <limits.h>
 #include <signal.h>
+#include <stdint.h>
+#include <stddef.h>
 
 // stdl includes
 #include <stdexcept>
@@ -11,5 +13,11 @@
 void hexdump(void *pAddressIn, long  lSize);
 unsigned int strtol_helper(char c, char* arg, unsigned int const* defaults) throw (std::runtime_error);
 sighandler_t signal_helper(int signo, sighandler_t func) throw (std::runtime_error);
+// case insensitive hashes of domain names
+uint32_t hash_helper(const char* s, size_t len);
+uint64_t hash64_helper(const char* s, size_t len);
+// copy src lowercased to dst, which may be src, and return its hash64_helper()
+uint64_t lowercase_helper(char* dst, const char* src, size_t len);
+bool nocase_equal_helper(const char* a, const char* b, size_t len);
 
 #endif // HELPER_H
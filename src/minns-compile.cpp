@@ -0,0 +1,64 @@
+// libc includes
+#include <stdlib.h>
+#include <unistd.h>
+
+// stdl includes
+#include <iostream>
+#include <stdexcept>
+
+// project includes
+#include "helper.h"
+#include "trace.h"
+#include "DnsResolver.h"
+#include "HostsImage.h"
+
+// usings
+using namespace std;
+
+void print_usage(char* program){
+    cout << "Usage: " << program << " [options] HOSTSFILE IMAGEFILE" << endl;
+    cout << endl;
+    cout << " Compile HOSTSFILE into IMAGEFILE, which minns -f loads without parsing" << endl;
+    cout << endl;
+    cout << "     -m MAXALIASES    maximum MAXALIASES aliases per entry (default is " << DnsResolver::DEFAULT_MAX_ALIASES[0] << ")" << endl;
+    cout << "     -i MAXIALIASES   maximum MAXIALIASES addresses per alias (default is " << DnsResolver::DEFAULT_MAX_INVERSE_ALIASES[0] << ")" << endl;
+    cout << endl;
+    cout << "Read README file for some (not many) details" << endl;
+}
+
+int main(int argc, char* argv[]){
+    try {
+        unsigned int maxaliases = DnsResolver::DEFAULT_MAX_ALIASES[0]; //m
+        unsigned int maxinversealiases = DnsResolver::DEFAULT_MAX_INVERSE_ALIASES[0]; //i
+
+        int opt;
+        while ((opt = getopt(argc, argv, "hm:i:")) != -1) {
+            switch (opt) {
+            case 'h':
+                print_usage(argv[0]);
+                exit(0);
+            case 'm':
+                maxaliases = strtol_helper('m',optarg,&DnsResolver::DEFAULT_MAX_ALIASES[1]);
+                break;
+            case 'i':
+                maxinversealiases = strtol_helper('i',optarg,&DnsResolver::DEFAULT_MAX_INVERSE_ALIASES[1]);
+                break;
+            default: // ?
+                print_usage(argv[0]);
+                return -1;
+            }
+        }
+        if (argc - optind != 2) {
+            print_usage(argv[0]);
+            return -1;
+        }
+
+        HostsImage::compile(argv[optind], argv[optind + 1], maxaliases, maxinversealiases);
+        HostsImage image(argv[optind + 1]);
+        cout << argv[optind + 1] << ": " << image.size() << " names" << endl;
+        return 0;
+    } catch (std::exception& e) {
+        cfatal << "Exception: " << e.what() << endl;
+        return -1;
+    }
+}
@@ -23,9 +23,17 @@ void print_usage(char* program){
     cout << " Resolver options" << endl;
     cout << "     -f FILENAME      use hosts file FILE (default is " << DnsServer::DEFAULT_HOSTS_FILE[0] << ")" << endl;
     cout << "     -c CACHESIZE     set resolver cache size to CACHESIZE (default is " << DnsResolver::DEFAULT_CACHE_SIZE[0] << ")" << endl;
+    cout << "     -s SHARDS        split resolver cache into SHARDS independently locked parts (default is " << DnsResolver::DEFAULT_CACHE_SHARDS[0] << ")" << endl;
+    cout << "     -e POLICY        use cache replacement POLICY, one of lru, clock, tinylfu, arc (default is " << DnsResolver::CACHE_POLICY_NAMES[DnsResolver::DEFAULT_CACHE_POLICY] << ")" << endl;
+    cout << "     -g NEGSIZE       remember up to NEGSIZE names missing from FILE, 0 to disable (default is " << DnsResolver::DEFAULT_NEGATIVE_CACHE_SIZE[0] << ")" << endl;
     cout << "     -m MAXALIASES    maximum MAXALIASES aliases per entry (default is " << DnsResolver::DEFAULT_MAX_ALIASES[0] << ")" << endl;
     cout << "     -i MAXIALIASES   maximum MAXIALIASES addresses per alias (default is " << DnsResolver::DEFAULT_MAX_INVERSE_ALIASES[0] << ")" << endl;
-    cout << "     -n               do *not* stat FILE for changes on each resolve (faster) (default is " << DnsResolver::DEFAULT_NOSTATFLAG << ")" << endl;
+    cout << "     -n               do *not* watch FILE for changes (default is " << DnsResolver::DEFAULT_NOSTATFLAG << ")" << endl;
+    cout << "     -x               index all of FILE in memory, never rescan it on a cache miss (default is " << DnsResolver::DEFAULT_INDEXFLAG << ")" << endl;
+    cout << "     -k               index FILE with a minimal perfect hash, implies -x (default is " << DnsResolver::DEFAULT_PERFECTFLAG << ")" << endl;
+    cout << "     -j LOADTHREADS   index FILE with up to LOADTHREADS threads (default is " << DnsResolver::DEFAULT_LOAD_THREADS[0] << ")" << endl;
+    cout << "     -w DUMPFILE      save the cache to DUMPFILE and warm it up from there at startup (default is none)" << endl;
+    cout << "     -l INTERVAL      save the cache every INTERVAL seconds (default is " << DnsServer::DEFAULT_DUMP_INTERVAL[0] << ")" << endl;
     cout << endl;
     cout << " Network options" << endl;
     cout << "     -t TCPPORT       use TCP port TCPPORT (default is " << DnsServer::DEFAULT_TCP_PORT[0] << ")" << endl;
@@ -44,9 +52,17 @@ int main(int argc, char* argv[]){
         strncpy (cachefile,DnsServer::DEFAULT_HOSTS_FILE, DnsServer::MAX_FILE_NAME);
 
         unsigned int cachesize = DnsResolver::DEFAULT_CACHE_SIZE[0]; // c
+        unsigned int cacheshards = DnsResolver::DEFAULT_CACHE_SHARDS[0]; // s
+        DnsResolver::CachePolicy cachepolicy = DnsResolver::DEFAULT_CACHE_POLICY; // e
+        unsigned int negsize = DnsResolver::DEFAULT_NEGATIVE_CACHE_SIZE[0]; // g
         unsigned int maxaliases = DnsResolver::DEFAULT_MAX_ALIASES[0]; //m
         unsigned int maxinversealiases = DnsResolver::DEFAULT_MAX_INVERSE_ALIASES[0]; //i
         bool nostatflag = DnsResolver::DEFAULT_NOSTATFLAG;
+        bool indexflag = DnsResolver::DEFAULT_INDEXFLAG; // x
+        bool perfectflag = DnsResolver::DEFAULT_PERFECTFLAG; // k
+        unsigned int loadthreads = DnsResolver::DEFAULT_LOAD_THREADS[0]; // j
+        char dumpfile[DnsServer::MAX_FILE_NAME] = ""; // w
+        unsigned int dumpinterval = DnsServer::DEFAULT_DUMP_INTERVAL[0]; // l
 
         // DnsServer options
         unsigned int udpthreads = DnsServer::DEFAULT_UDP_WORKERS[0]; // d
@@ -58,7 +74,7 @@ int main(int argc, char* argv[]){
         unsigned int tcptimeout = DnsServer::DEFAULT_TCP_TIMEOUT[0]; // o
 
         char opt;
-        while ((opt = getopt(argc, argv, "nhf:c:m:i:d:p:t:u:")) != -1) {
+        while ((opt = getopt(argc, argv, "nxkhf:c:s:e:g:m:i:j:w:l:d:p:t:u:")) != -1) {
             stringstream ss;
             try {
                 switch (opt) {
@@ -68,15 +84,42 @@ int main(int argc, char* argv[]){
                 case 'n':
                     nostatflag = true;
                     break;
+                case 'x':
+                    indexflag = true;
+                    break;
+                case 'k':
+                    perfectflag = true;
+                    break;
                 case 'f':
                     if (strlen(optarg) < DnsServer::MAX_FILE_NAME)
                         strncpy(cachefile, optarg, DnsServer::MAX_FILE_NAME);
                     else
                         throw std::runtime_error("File name too long");
                     break;
+                case 'w':
+                    if (strlen(optarg) < DnsServer::MAX_FILE_NAME)
+                        strncpy(dumpfile, optarg, DnsServer::MAX_FILE_NAME);
+                    else
+                        throw std::runtime_error("File name too long");
+                    break;
+                case 'l':
+                    dumpinterval = strtol_helper('l',optarg,&DnsServer::DEFAULT_DUMP_INTERVAL[1]);
+                    break;
+                case 'j':
+                    loadthreads = strtol_helper('j',optarg,&DnsResolver::DEFAULT_LOAD_THREADS[1]);
+                    break;
                 case 'c':
                     cachesize = strtol_helper('c',optarg,&DnsResolver::DEFAULT_CACHE_SIZE[1]);
                     break;
+                case 's':
+                    cacheshards = strtol_helper('s',optarg,&DnsResolver::DEFAULT_CACHE_SHARDS[1]);
+                    break;
+                case 'e':
+                    cachepolicy = DnsResolver::parse_cache_policy(optarg);
+                    break;
+                case 'g':
+                    negsize = strtol_helper('g',optarg,&DnsResolver::DEFAULT_NEGATIVE_CACHE_SIZE[1]);
+                    break;
                 case 'm':
                     maxaliases = strtol_helper('m',optarg,&DnsResolver::DEFAULT_MAX_ALIASES[1]);
                     break;
@@ -108,9 +151,17 @@ int main(int argc, char* argv[]){
         cout << " Resolver options" << endl;
         cout << "     -f FILENAME      use hosts file FILE (using " << cachefile << ")" << endl;
         cout << "     -c CACHESIZE     set resolver cache size to CACHESIZE (using " << cachesize << ")" << endl;
+        cout << "     -s SHARDS        split resolver cache into SHARDS independently locked parts (using " << cacheshards << ")" << endl;
+        cout << "     -e POLICY        use cache replacement POLICY, one of lru, clock, tinylfu, arc (using " << DnsResolver::CACHE_POLICY_NAMES[cachepolicy] << ")" << endl;
+        cout << "     -g NEGSIZE       remember up to NEGSIZE names missing from FILE, 0 to disable (using " << negsize << ")" << endl;
         cout << "     -m MAXALIASES    maximum MAXALIASES aliases per entry (using " << maxaliases << ")" << endl;
         cout << "     -i MAXIALIASES   maximum MAXIALIASES addresses per alias (using " << maxinversealiases << ")" << endl;
-        cout << "     -n               do *not* stat FILE for changes on each resolve (faster) (using " << nostatflag << ")" << endl;
+        cout << "     -n               do *not* watch FILE for changes (using " << nostatflag << ")" << endl;
+        cout << "     -x               index all of FILE in memory, never rescan it on a cache miss (using " << indexflag << ")" << endl;
+        cout << "     -k               index FILE with a minimal perfect hash, implies -x (using " << perfectflag << ")" << endl;
+        cout << "     -j LOADTHREADS   index FILE with up to LOADTHREADS threads (using " << loadthreads << ")" << endl;
+        cout << "     -w DUMPFILE      save the cache to DUMPFILE and warm it up from there at startup (using " << (dumpfile[0] ? dumpfile : "none") << ")" << endl;
+        cout << "     -l INTERVAL      save the cache every INTERVAL seconds (using " << dumpinterval << ")" << endl;
         cout << endl;
         cout << " Network options" << endl;
         cout << "     -t TCPPORT       use TCP port TCPPORT (using " << tcpport << ")" << endl;
@@ -121,8 +172,8 @@ int main(int argc, char* argv[]){
         cout << endl;
 
 
-        DnsResolver r(cachefile, cachesize, maxaliases, maxinversealiases, nostatflag);
-        DnsServer a(r, udpport, tcpport, udpthreads, tcpthreads, tcptimeout);
+        DnsResolver r(cachefile, cachesize, maxaliases, maxinversealiases, nostatflag, indexflag, cacheshards, cachepolicy, negsize, perfectflag, loadthreads);
+        DnsServer a(r, udpport, tcpport, udpthreads, tcpthreads, tcptimeout, dumpfile, dumpinterval);
         a.start();
         return 0;
     } catch (std::exception& e) {
@@ -0,0 +1,52 @@
+// libstdc++ includes
+#include <vector>
+
+// libc includes
+#include <stdio.h>
+#include <stdlib.h>
+
+// project includes
+#include "BloomFilter.h"
+#include "helper.h"
+#include "gtest/gtest.h"
+
+// usings
+using namespace std;
+
+TEST(BloomFilter, NoFalseNegatives) {
+
+unsigned int seed = 1;
+vector<uint32_t> added;
+BloomFilter filter(10000);
+for (int i = 0; i < 10000; i++) {
+    added.push_back(rand_r(&seed) * 2654435761u);
+    filter.add(added.back());
+}
+for (size_t i = 0; i < added.size(); i++)
+    EXPECT_TRUE(filter.contains(added[i]));
+}
+
+TEST(BloomFilter, FewFalsePositives) {
+
+char name[32];
+BloomFilter filter(10000);
+for (int i = 0; i < 10000; i++) {
+    int len = snprintf(name, sizeof(name), "host%d.example", i);
+    filter.add(hash_helper(name, len));
+}
+int positives = 0;
+for (int i = 0; i < 100000; i++) {
+    int len = snprintf(name, sizeof(name), "junk%d.example", i);
+    if (filter.contains(hash_helper(name, len)))
+        positives++;
+}
+// about 1% expected
+EXPECT_LT (positives, 2000);
+}
+
+TEST(BloomFilter, Empty) {
+
+BloomFilter filter(0);
+EXPECT_FALSE(filter.contains(0));
+EXPECT_FALSE(filter.contains(12345));
+}
@@ -0,0 +1,138 @@
+// Throughput of concurrent DnsResolver::resolve() calls on a warm cache, for an
+// increasing number of worker threads, a few LRU cache shard counts and the
+// CLOCK cache. Then the hit rate of every cache policy, for a cache an eighth
+// the size of the hosts file, under skewed lookups mixed with a scan.
+//
+//    usage: cacheBench [QUERIES_PER_THREAD]
+
+// libc includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+// stdl includes
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+// project includes
+#include "DnsResolver.h"
+#include "Thread.h"
+
+using namespace std;
+
+static const unsigned int NAMES = 4096;
+
+class BenchRunnable : public Thread::Runnable {
+    DnsResolver& resolver;
+    const vector<string>& names;
+    unsigned int queries;
+    unsigned int seed;
+public:
+    BenchRunnable(DnsResolver& r, const vector<string>& n, unsigned int q, unsigned int s)
+        : resolver(r), names(n), queries(q), seed(s) {}
+
+    void* main(){
+        addr_set_t result;
+        for (unsigned int i = 0; i < queries; i++) {
+            result.clear();
+            resolver.resolve(names[rand_r(&seed) % names.size()], result);
+        }
+        return NULL;
+    }
+};
+
+static double now(){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char* argv[]){
+    unsigned int queries = (argc > 1) ? atoi(argv[1]) : 200000;
+
+    char path[] = "/tmp/cacheBench.XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    vector<string> names;
+    ofstream out(path);
+    for (unsigned int i = 0; i < NAMES; i++) {
+        stringstream ss;
+        ss << "host" << i << ".bench.example";
+        names.push_back(ss.str());
+        out << "10." << (i >> 16) % 256 << "." << (i >> 8) % 256 << "." << i % 256 << " " << names.back() << "\n";
+    }
+    out.close();
+
+    // keep the resolver's tracing out of the measurements
+    clog.setstate(ios::badbit);
+
+    unsigned int shardcounts[] = {1, 8, 64};
+    unsigned int threadcounts[] = {1, 2, 4, 8, 16};
+
+    cout << "queries/s, " << NAMES << " names all cached, " << queries << " queries per thread" << endl;
+    cout << "threads";
+    for (unsigned int s = 0; s < 3; s++)
+        cout << "\t" << shardcounts[s] << " shards";
+    cout << "\tclock" << endl;
+
+    for (unsigned int t = 0; t < 5; t++) {
+        cout << threadcounts[t];
+        for (unsigned int s = 0; s < 4; s++) {
+            // the last column is the CLOCK cache, which has no shards
+            DnsResolver resolver(path, NAMES, 5, 5, true, true, (s < 3) ? shardcounts[s] : 1,
+                                 (s < 3) ? DnsResolver::CACHE_LRU : DnsResolver::CACHE_CLOCK);
+            addr_set_t warm;
+            for (unsigned int i = 0; i < NAMES; i++)
+                resolver.resolve(names[i], warm);
+
+            vector<BenchRunnable*> runnables;
+            vector<Thread*> threads;
+            for (unsigned int i = 0; i < threadcounts[t]; i++) {
+                runnables.push_back(new BenchRunnable(resolver, names, queries, i + 1));
+                threads.push_back(new Thread(*runnables.back()));
+            }
+            double start = now();
+            for (unsigned int i = 0; i < threads.size(); i++)
+                threads[i]->run();
+            for (unsigned int i = 0; i < threads.size(); i++)
+                threads[i]->join(NULL);
+            double elapsed = now() - start;
+            for (unsigned int i = 0; i < threads.size(); i++) {
+                delete threads[i];
+                delete runnables[i];
+            }
+            cout << "\t" << (unsigned long) (threadcounts[t] * queries / elapsed);
+        }
+        cout << endl;
+    }
+
+    cout << endl << "hit rate, cache of " << NAMES / 8 << " names, skewed lookups with one in ";
+    cout << "four of them scanning all names" << endl;
+    for (int p = 0; p < DnsResolver::CACHE_POLICIES; p++) {
+        DnsResolver::CachePolicy policy = static_cast<DnsResolver::CachePolicy>(p);
+        DnsResolver resolver(path, NAMES / 8, 5, 5, true, true, 1, policy);
+        unsigned int seed = 1;
+        unsigned int scan = 0;
+        addr_set_t result;
+        for (unsigned int i = 0; i < queries; i++) {
+            unsigned int n;
+            if (i % 4 == 0) {
+                n = scan++ % NAMES;
+            } else {
+                // the cube of a uniform number, low names are much hotter
+                double u = rand_r(&seed) / (RAND_MAX + 1.0);
+                n = (unsigned int) (u * u * u * NAMES);
+            }
+            result.clear();
+            resolver.resolve(names[n], result);
+        }
+        cout << DnsResolver::CACHE_POLICY_NAMES[p] << "\t" <<
+            100.0 * resolver.cache_hits() / (resolver.cache_hits() + resolver.cache_misses()) << "%" << endl;
+    }
+
+    unlink(path);
+    return 0;
+}
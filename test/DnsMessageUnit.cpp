@@ -0,0 +1,346 @@
+// libstdc++ includes
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+
+// libc includes
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+// project includes
+#include "helper.h"
+#include "DnsMessage.h"
+#include "gtest/gtest.h"
+
+// usings
+using namespace std;
+
+// a query with a header asking for recursion and one question per name
+static string query(const char* names[], size_t count, uint16_t qtype = 1){
+    string q("\x12\x34\x01\x00", 4);
+    q += (char) 0; q += (char) count;
+    q += string(6, '\0');
+    for (size_t i = 0; i < count; i++) {
+        string name(names[i]);
+        size_t start = 0;
+        while (start < name.size()) {
+            size_t dot = name.find('.', start);
+            if (dot == string::npos) dot = name.size();
+            q += (char) (dot - start);
+            q += name.substr(start, dot - start);
+            start = dot + 1;
+        }
+        q += '\0';
+        q += (char) (qtype >> 8); q += (char) qtype;
+        q += '\0'; q += '\1';
+    }
+    return q;
+}
+
+TEST(DnsQuery, ParsesInPlace) {
+
+const char* names[] = {"SomeHost.Example", "", "ble"};
+string q = query(names, 3);
+DnsQuery view(q.data(), q.size());
+EXPECT_EQ (0x1234, view.id);
+EXPECT_TRUE (view.rd);
+EXPECT_EQ (3, view.qdcount);
+EXPECT_EQ (q.size(), view.end);
+
+const char* keys[] = {"somehost.example", "", "ble"};
+size_t offset = 12;
+for (int i = 0; i < 3; i++) {
+    const DnsQuery::Question& question = view.questions[i];
+    // names point into the buffer
+    EXPECT_EQ (q.data() + offset, question.wire);
+    EXPECT_EQ (string(keys[i]), string(question.key, question.keylen));
+    EXPECT_EQ (hash64_helper(keys[i], strlen(keys[i])), question.hash);
+    EXPECT_EQ (1, question.qtype);
+    EXPECT_EQ (1, question.qclass);
+    offset += question.wirelen + 4;
+}
+}
+
+TEST(DnsQuery, RejectsMalformedQueries) {
+
+const char* names[] = {"somehost.example"};
+string good = query(names, 1);
+
+vector<string> bad;
+bad.push_back(good.substr(0, 11));                // short header
+bad.push_back(good.substr(0, 20));                // label cut short
+bad.push_back(good.substr(0, 29));                // no end label
+bad.push_back(good.substr(0, good.size() - 1));   // no room for the class
+string response(good); response[2] |= 0x80;
+bad.push_back(response);
+string pointer(good); pointer[12] = (char) 0xC0;
+bad.push_back(pointer);
+string many(good); many[5] = 9;
+bad.push_back(many);
+// five labels of 60 make a name longer than 253
+string label(60, 'x');
+string name = label + "." + label + "." + label + "." + label + "." + label;
+const char* longnames[] = {name.c_str()};
+string longname = query(longnames, 1);
+bad.push_back(longname);
+// records past the end, two OPT records, OPT for a name
+string record(good); record[11] = 1;
+bad.push_back(record + string("\0\0\x29\x10\0\0\0\0\0\0", 10));
+bad.push_back(record + string("\0\0\x29\x10\0\0\0\0\0\0\x05", 11));
+string opt("\0\0\x29\x10\0\0\0\0\0\0\0", 11);
+string twice(good); twice[11] = 2;
+bad.push_back(twice + opt + opt);
+bad.push_back(record + "\xC0\x0C" + opt.substr(1));
+
+for (size_t i = 0; i < bad.size(); i++)
+    EXPECT_THROW(DnsQuery(bad[i].data(), bad[i].size()), DnsMessage::DnsException) << i;
+}
+
+TEST(DnsQuery, FollowsCompressionPointers) {
+
+// www.example.com and mail.example.com both point at example.com
+const char* names[] = {"example.com"};
+string q = query(names, 1);
+q[5] = 3;
+q += string("\x03www\xC0\x0C\x00\x01\x00\x01", 10);
+q += string("\x04MAIL\xC0\x0C\x00\x01\x00\x01", 11);
+// and an additional record named by a pointer
+q[11] = 1;
+q += string("\xC0\x1D\x00\x01\x00\x01\x00\x00\x00\x00\x00\x04\x0A\x00\x00\x01", 16);
+DnsQuery view(q.data(), q.size());
+ASSERT_EQ (3, view.qdcount);
+EXPECT_EQ (string("www.example.com"), string(view.questions[1].key));
+EXPECT_EQ (hash64_helper("www.example.com", 15), view.questions[1].hash);
+EXPECT_EQ (6u, view.questions[1].wirelen);
+EXPECT_EQ (string("mail.example.com"), string(view.questions[2].key));
+EXPECT_EQ (7u, view.questions[2].wirelen);
+EXPECT_EQ (12u + 13 + 4 + 10 + 11, view.end);
+
+// and are printed as they are looked up
+ostringstream os;
+os << view;
+EXPECT_NE (string::npos, os.str().find("(q= \'mail.example.com\')"));
+
+// pointers that don't point back, at the header, past the end, or that
+// make names too long, are all rejected
+vector<string> bad;
+string loop(q); loop[34] = 0x1D;
+bad.push_back(loop);
+string self(q); self[12] = (char) 0xC0; self[13] = 0x0C;
+bad.push_back(self);
+string forward(q); forward[34] = 0x30;
+bad.push_back(forward);
+string header(q); header[34] = 0x02;
+bad.push_back(header);
+bad.push_back(q.substr(0, 34));
+string record(q); record[q.size() - 15] = 0x1D + 10 + 11;
+bad.push_back(record);
+// each name adds four labels of 60 to the one before it
+string longname = query(names, 1);
+longname[5] = 2;
+string label = "\x3C" + string(60, 'x');
+longname += label + label + label + label + "\xC0\x0C" + string("\0\1\0\1", 4);
+longname += label + label + label + label + "\xC0\x1D" + string("\0\1\0\1", 4);
+bad.push_back(longname);
+
+for (size_t i = 0; i < bad.size(); i++)
+    EXPECT_THROW(DnsQuery(bad[i].data(), bad[i].size()), DnsMessage::DnsException) << i;
+}
+
+TEST(DnsQuery, RespondsInPlace) {
+
+DnsResolver resolver("test/simplehosts.txt", 10, 10, 10, true, true, 1);
+const char* names[] = {"AnotherHost", "nope", "bla"};
+string q = query(names, 3);
+size_t qlen = q.size();
+// an additional section the response drops
+q += string("\0\0\x10\0\x01\0\0\0\0\0\0", 11);
+q[11] = 1;
+
+char buff[512];
+memcpy(buff, q.data(), q.size());
+DnsQuery view(buff, q.size());
+size_t len = view.respond(resolver, buff, sizeof(buff));
+
+// header and questions as they were, but for the flags and counts
+EXPECT_EQ (string("\x12\x34\x85\x00\x00\x03\x00\x03\x00\x00\x00\x00", 12), string(buff, 12));
+EXPECT_EQ (q.substr(12, qlen - 12), string(buff + 12, qlen - 12));
+ASSERT_EQ (qlen + 3 * DnsResolver::ANSWER_RECORD_SIZE, len);
+
+// each answer points at its own question, bla has two addresses
+const char* expected[] = {"\xC0\x0C", "\xC0\x27", "\xC0\x27"};
+const char* addresses[] = {"\xC0\xA8\x01\x02", "\xC0\xA8\x01\x01", "\xC0\xA8\x01\x09"};
+for (int i = 0; i < 3; i++) {
+    const char* record = buff + qlen + i * DnsResolver::ANSWER_RECORD_SIZE;
+    EXPECT_EQ (string(expected[i], 2), string(record, 2)) << i;
+    EXPECT_EQ (string("\x00\x01\x00\x01\x00\x00\x00\x00\x00\x04", 10), string(record + 2, 10)) << i;
+    EXPECT_EQ (string(addresses[i], 4), string(record + 12, 4)) << i;
+}
+
+// names that aren't there are a name error
+const char* missing[] = {"nope"};
+q = query(missing, 1);
+memcpy(buff, q.data(), q.size());
+DnsQuery none(buff, q.size());
+EXPECT_EQ (q.size(), none.respond(resolver, buff, sizeof(buff)));
+EXPECT_EQ (string("\x85\x03\x00\x01\x00\x00", 6), string(buff + 2, 6));
+
+// reverse lookups, in their own buffer
+const char* reverse[] = {"4.1.168.192.in-addr.arpa"};
+q = query(reverse, 1, 12);
+DnsQuery ptr(q.data(), q.size());
+len = ptr.respond(resolver, buff, sizeof(buff));
+EXPECT_EQ (2, buff[7]);
+ASSERT_EQ (q.size() + 12 + 30 + 12 + 8, len);
+EXPECT_EQ (string("\xC0\x0C\x00\x0C\x00\x01\x00\x00\x00\x00\x00\x1E"
+                  "\x0Eyetanotherhost\x0D" "anotherdomain\x00", 42), string(buff + q.size(), 42));
+
+// too small a buffer for all answers, bla's are left out
+q = query(names, 3);
+DnsQuery small(q.data(), q.size());
+EXPECT_EQ (q.size() + DnsResolver::ANSWER_RECORD_SIZE, small.respond(resolver, buff, q.size() + 20));
+EXPECT_EQ (string("\x87\x00\x00\x03\x00\x01", 6), string(buff + 2, 6));
+// or even the questions
+EXPECT_THROW(small.respond(resolver, buff, q.size() - 1), DnsMessage::SerializeException);
+}
+
+TEST(DnsQuery, CompressesNames) {
+
+const char* path = "test/compresshosts.tmp";
+ofstream out(path);
+out << "10.0.0.1 www.example.com mail.example.com example.com\n";
+out << "10.0.0.2 www.example.com\n";
+out.close();
+DnsResolver resolver(path, 10, 10, 10, true, true, 1);
+char buff[512];
+
+// two addresses, each answer's owner a pointer instead of 17 bytes
+const char* names[] = {"www.example.com"};
+string q = query(names, 1);
+DnsQuery a(q.data(), q.size());
+size_t len = a.respond(resolver, buff, sizeof(buff));
+size_t full = q.size() + 2 * (17 + 14);
+EXPECT_EQ (q.size() + 2 * 16, len);
+RecordProperty("a_bytes_before", full);
+RecordProperty("a_bytes_after", len);
+
+// three names, the second and third point into the first
+const char* reverse[] = {"1.0.0.10.in-addr.arpa"};
+q = query(reverse, 1, 12);
+DnsQuery ptr(q.data(), q.size());
+len = ptr.respond(resolver, buff, sizeof(buff));
+full = q.size() + 3 * 12 + 17 + 18 + 13;
+ASSERT_EQ (q.size() + 3 * 12 + 17 + 7 + 2, len);
+RecordProperty("ptr_bytes_before", full);
+RecordProperty("ptr_bytes_after", len);
+const char* rdata = buff + q.size() + 12;
+EXPECT_EQ (string("\x03www\x07" "example\x03" "com\x00", 17), string(rdata, 17));
+size_t first = rdata - buff;
+rdata += 17 + 12;
+EXPECT_EQ (string("\x04mail\xC0", 6), string(rdata, 6));
+EXPECT_EQ ((char) (first + 4), rdata[6]);
+rdata += 7 + 12;
+EXPECT_EQ ((char) 0xC0, rdata[0]);
+EXPECT_EQ ((char) (first + 4), rdata[1]);
+
+// a name already asked for is pointed to whole, whatever its case
+const char* both[] = {"1.0.0.10.in-addr.arpa", "WWW.Example.com"};
+q = query(both, 2, 12);
+DnsQuery two(q.data(), q.size());
+len = two.respond(resolver, buff, sizeof(buff));
+ASSERT_EQ (q.size() + 3 * 12 + 2 + 7 + 2, len);
+size_t second = 12 + 23 + 4;
+EXPECT_EQ ((char) 0xC0, buff[q.size() + 12]);
+EXPECT_EQ ((char) second, buff[q.size() + 13]);
+
+unlink(path);
+}
+
+// a query with an OPT record advertising payload, of version
+static string edns(const string& q, uint16_t payload, char version = 0){
+    string e(q);
+    e[11] = 1;
+    e += '\0';
+    e += '\0'; e += '\x29';
+    e += (char) (payload >> 8); e += (char) payload;
+    e += '\0'; e += version;
+    e += string(4, '\0');
+    return e;
+}
+
+TEST(DnsQuery, TruncatesAndEchoesEdns) {
+
+// 40 addresses make 640 bytes of answers
+const char* path = "test/truncatehosts.tmp";
+ofstream out(path);
+for (int i = 1; i <= 40; i++)
+    out << "10.0.0." << i << " many.example many\n";
+out << "10.0.1.1 few.example\n";
+out.close();
+DnsResolver resolver(path, 10, 100, 100, true, true, 1);
+char buff[1232];
+
+// no EDNS, 512 bytes, the answers don't fit, so none go
+const char* names[] = {"few.example", "many.example"};
+string q = query(names, 2);
+DnsQuery plain(q.data(), q.size());
+EXPECT_FALSE (plain.edns);
+ASSERT_EQ (512u, plain.udp_size(sizeof(buff)));
+size_t len = plain.respond(resolver, buff, plain.udp_size(sizeof(buff)));
+// few.example was answered, many.example left out
+EXPECT_EQ (q.size() + DnsResolver::ANSWER_RECORD_SIZE, len);
+EXPECT_EQ (string("\x87\x00\x00\x02\x00\x01\x00\x00\x00\x00", 10), string(buff + 2, 10));
+
+// truncated to nothing is still no name error
+const char* many[] = {"many.example"};
+q = query(many, 1);
+DnsQuery alone(q.data(), q.size());
+EXPECT_EQ (q.size(), alone.respond(resolver, buff, 512));
+EXPECT_EQ (string("\x87\x00\x00\x01\x00\x00", 6), string(buff + 2, 6));
+
+// EDNS for 4096 bytes, capped to ours, everything fits and OPT is echoed
+q = edns(query(many, 1), 4096);
+DnsQuery large(q.data(), q.size());
+EXPECT_TRUE (large.edns);
+EXPECT_EQ (4096, large.payload);
+ASSERT_EQ (sizeof(buff), large.udp_size(sizeof(buff)));
+len = large.respond(resolver, buff, large.udp_size(sizeof(buff)));
+size_t qlen = q.size() - DnsQuery::OPT_SIZE;
+ASSERT_EQ (qlen + 40 * DnsResolver::ANSWER_RECORD_SIZE + DnsQuery::OPT_SIZE, len);
+EXPECT_EQ (string("\x85\x00\x00\x01\x00\x28\x00\x00\x00\x01", 10), string(buff + 2, 10));
+EXPECT_EQ (string("\x00\x00\x29\x04\xD0\x00\x00\x00\x00\x00\x00", 11), string(buff + len - 11, 11));
+
+// EDNS advertising less than 512 still gets 512
+q = edns(query(many, 1), 100);
+DnsQuery small(q.data(), q.size());
+EXPECT_EQ (512u, small.udp_size(sizeof(buff)));
+
+// unknown versions get BADVERS and no answers
+q = edns(query(many, 1), 4096, 1);
+DnsQuery future(q.data(), q.size());
+len = future.respond(resolver, buff, sizeof(buff));
+EXPECT_EQ (q.size(), len);
+EXPECT_EQ (string("\x85\x00\x00\x01\x00\x00\x00\x00\x00\x01", 10), string(buff + 2, 10));
+EXPECT_EQ (1, buff[len - 6]);
+
+unlink(path);
+}
+
+TEST(DnsQuery, KeysHashAsTheyLowercase) {
+// every length and alignment through the 16 and 8 byte loops and the tail,
+// with bytes from 0x80 up, that are left alone
+const char name[] = "Www.EXAMPLE.com.\xC3\x89" "cole.Mail-01.ZZZ.aaa.Bla.Example.ORG.XYZ.abc";
+char lowered[sizeof(name)];
+for (size_t i = 0; i < sizeof(name) - 1; i++)
+    lowered[i] = (name[i] >= 'A' && name[i] <= 'Z') ? (name[i] | 0x20) : name[i];
+for (size_t start = 0; start < 8; start++)
+    for (size_t len = 0; start + len < sizeof(name); len++) {
+        char dst[sizeof(name)];
+        uint64_t hash = lowercase_helper(dst, name + start, len);
+        EXPECT_EQ (string(lowered + start, len), string(dst, len));
+        EXPECT_EQ (hash64_helper(lowered + start, len), hash);
+        EXPECT_EQ (hash64_helper(name + start, len), hash);
+    }
+}
@@ -2,8 +2,17 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <vector>
+
+// libc includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
 
 // project includes
+#include "helper.h"
 #include "DnsResolver.h"
 #include "gtest/gtest.h"
 
@@ -17,3 +26,502 @@ DnsResolver resolver("test/simplehosts.txt", 10, 10, 2);
 EXPECT_NO_THROW(string result(resolver.resolve_to_string("bla")));
 EXPECT_EQ (1,1);
 }
+
+TEST(SucessfulResolution, IndexedNames) {
+
+DnsResolver resolver("test/simplehosts.txt", 10, 10, 2, false, true);
+EXPECT_EQ (string(" 192.168.1.1 192.168.1.9"), resolver.resolve_to_string("bla"));
+EXPECT_EQ (string(" 192.168.1.4"), resolver.resolve_to_string("mamene"));
+EXPECT_THROW(resolver.resolve_to_string("nonexistent"), DnsResolver::ResolveException);
+}
+
+TEST(SucessfulResolution, PerfectlyIndexedNames) {
+
+DnsResolver resolver("test/simplehosts.txt", 10, 10, 2, false, false, 1, DnsResolver::CACHE_LRU, 0, true);
+EXPECT_EQ (string(" 192.168.1.1 192.168.1.9"), resolver.resolve_to_string("bla"));
+EXPECT_EQ (string(" 192.168.1.4"), resolver.resolve_to_string("mamene"));
+EXPECT_THROW(resolver.resolve_to_string("nonexistent"), DnsResolver::ResolveException);
+}
+
+TEST(SucessfulResolution, CompiledImage) {
+
+const char* path = "test/simplehosts.img";
+HostsImage::compile("test/simplehosts.txt", path, 10, 2);
+EXPECT_TRUE(HostsImage::is_image(path));
+EXPECT_FALSE(HostsImage::is_image("test/simplehosts.txt"));
+
+DnsResolver resolver(path, 10, 10, 2);
+EXPECT_EQ (string(" 192.168.1.1 192.168.1.9"), resolver.resolve_to_string("bla"));
+EXPECT_EQ (string(" 192.168.1.4"), resolver.resolve_to_string("mamene"));
+EXPECT_THROW(resolver.resolve_to_string("nonexistent"), DnsResolver::ResolveException);
+unlink(path);
+}
+
+TEST(SucessfulResolution, CorruptImage) {
+
+const char* path = "test/corrupt.img";
+HostsImage::compile("test/simplehosts.txt", path, 10, 2);
+fstream image(path, ios::in | ios::out | ios::binary);
+image.seekg(-1, ios::end);
+char last = image.get();
+image.seekp(-1, ios::end);
+image.put(last ^ 1);
+image.close();
+EXPECT_THROW(DnsResolver resolver(path, 10, 10, 2), DnsResolver::ResolveException);
+unlink(path);
+}
+
+static string names_of(DnsResolver& resolver, const char* address){
+    struct in_addr ip;
+    inet_pton(AF_INET, address, &ip);
+    name_list_t names;
+    if (!resolver.resolve_address(ip, names))
+        return "missing";
+    string joined;
+    for (size_t i = 0; i < names.size(); i++)
+        joined += " " + names[i];
+    return joined;
+}
+
+TEST(SucessfulResolution, ReverseLookups) {
+
+// scan mode, index mode, perfect index mode and an image
+const char* image = "test/reverse.img";
+HostsImage::compile("test/simplehosts.txt", image, 10, 2);
+for (int mode = 0; mode < 4; mode++) {
+    DnsResolver resolver((mode == 3) ? image : "test/simplehosts.txt", 10, 10, 2, false,
+                         mode == 1, 1, DnsResolver::CACHE_LRU, 0, mode == 2);
+    EXPECT_EQ (string(" somehost.somedomain somehost bla"), names_of(resolver, "192.168.1.1"));
+    EXPECT_EQ (string(" farfromsober closetosober"), names_of(resolver, "200.200.200.200"));
+    EXPECT_EQ (string(" enorme.coiso bla"), names_of(resolver, "192.168.1.9"));
+    EXPECT_EQ (string("missing"), names_of(resolver, "192.168.1.3"));
+    EXPECT_EQ (string("missing"), names_of(resolver, "10.9.9.9"));
+}
+unlink(image);
+}
+
+TEST(SucessfulResolution, Wildcards) {
+
+// in an order that splits edges of the trie
+const char* path = "test/wildhosts.tmp";
+const char* image = "test/wildhosts.img";
+ofstream out(path);
+out << "10.0.0.2 *.b.internal.example\n";
+out << "10.0.0.1 *.internal.example\n";
+out << "10.0.0.3 exact.internal.example\n";
+out << "10.0.0.5 *.internalx.example\n";
+out << "10.0.0.6 *.c.b.internal.example\n";
+out << "10.0.0.7 *.c.b.internal.example\n";
+out.close();
+HostsImage::compile(path, image, 10, 2);
+
+for (int mode = 0; mode < 3; mode++) {
+    DnsResolver resolver((mode == 2) ? image : path, 10, 10, 2, false, mode == 1);
+    for (int i = 0; i < 2; i++) {
+        EXPECT_EQ (string(" 10.0.0.1"), resolver.resolve_to_string("a.internal.example"));
+        EXPECT_EQ (string(" 10.0.0.1"), resolver.resolve_to_string("x.y.internal.example"));
+        EXPECT_EQ (string(" 10.0.0.1"), resolver.resolve_to_string("b.internal.example"));
+        EXPECT_EQ (string(" 10.0.0.2"), resolver.resolve_to_string("x.b.internal.example"));
+        EXPECT_EQ (string(" 10.0.0.3"), resolver.resolve_to_string("exact.internal.example"));
+        EXPECT_EQ (string(" 10.0.0.5"), resolver.resolve_to_string("q.internalx.example"));
+        EXPECT_EQ (string(" 10.0.0.6 10.0.0.7"), resolver.resolve_to_string("z.c.b.internal.example"));
+        EXPECT_THROW(resolver.resolve_to_string("internal.example"), DnsResolver::ResolveException);
+        EXPECT_THROW(resolver.resolve_to_string("nothing.example"), DnsResolver::ResolveException);
+    }
+    // only the exact name ever made it into the cache
+    EXPECT_EQ (1u, resolver.cache_hits());
+    EXPECT_EQ (12u, resolver.wildcard_hits());
+}
+unlink(path);
+unlink(image);
+}
+
+TEST(SucessfulResolution, CaseInsensitiveNames) {
+
+const char* path = "test/casehosts.tmp";
+const char* image = "test/casehosts.img";
+ofstream out(path);
+out << "10.0.0.1 MixedCase.Example mixedcase.example\n";
+out << "10.0.0.2 a.rather.long.name.in.Capitals.EXAMPLE\n";
+out << "10.0.0.3 *.Wild.Example\n";
+out.close();
+HostsImage::compile(path, image, 10, 2);
+
+// scan mode, index mode, perfect index mode and an image
+for (int mode = 0; mode < 4; mode++) {
+    DnsResolver resolver((mode == 3) ? image : path, 10, 10, 2, false,
+                         mode == 1, 1, DnsResolver::CACHE_LRU, 0, mode == 2);
+    EXPECT_EQ (string(" 10.0.0.1"), resolver.resolve_to_string("mixedcase.example"));
+    EXPECT_EQ (string(" 10.0.0.1"), resolver.resolve_to_string("MIXEDCASE.EXAMPLE"));
+    EXPECT_EQ (string(" 10.0.0.1"), resolver.resolve_to_string("MixedCase.Example"));
+    EXPECT_EQ (string(" 10.0.0.2"), resolver.resolve_to_string("A.RATHER.LONG.NAME.IN.CAPITALS.EXAMPLE"));
+    EXPECT_EQ (string(" 10.0.0.3"), resolver.resolve_to_string("X.wild.EXAMPLE"));
+    EXPECT_THROW(resolver.resolve_to_string("MixedCase.Examples"), DnsResolver::ResolveException);
+    // all spellings share one cache entry
+    EXPECT_EQ (2u, resolver.cache_hits());
+    EXPECT_EQ (string(" mixedcase.example"), names_of(resolver, "10.0.0.1"));
+}
+unlink(path);
+unlink(image);
+}
+
+TEST(SucessfulResolution, ParallelLoad) {
+
+// several chunks' worth of lines, with names and addresses that repeat
+// across chunks
+const char* path = "test/parallelhosts.tmp";
+ofstream out(path);
+for (int i = 0; i < 120000; i++)
+    out << "10." << i / 65536 << "." << i / 256 % 256 << "." << i % 256 << " name" << i << " Shared\n";
+out << "10.0.0.0 last *.wild.example\n";
+out << "10.0.0.9 name0\n";
+out.close();
+
+for (int threads = 1; threads <= 16; threads *= 4) {
+    for (int perfect = 0; perfect < 2; perfect++) {
+        DnsResolver resolver(path, 10, 5, 2, true, true, 1, DnsResolver::CACHE_LRU, 0, perfect, threads);
+        EXPECT_EQ (string(" 10.0.0.0 10.0.0.1"), resolver.resolve_to_string("shared"));
+        EXPECT_EQ (string(" 10.0.0.0 10.0.0.9"), resolver.resolve_to_string("name0"));
+        EXPECT_EQ (string(" 10.1.212.191"), resolver.resolve_to_string("name119999"));
+        EXPECT_EQ (string(" 10.0.0.0"), resolver.resolve_to_string("x.wild.example"));
+        EXPECT_THROW(resolver.resolve_to_string("name120000"), DnsResolver::ResolveException);
+        EXPECT_EQ (string(" name0 shared last *.wild.example"), names_of(resolver, "10.0.0.0"));
+        EXPECT_EQ (string(" name119999 shared"), names_of(resolver, "10.1.212.191"));
+    }
+}
+unlink(path);
+}
+
+TEST(SucessfulResolution, ClockCache) {
+
+// a cache of two names, so names keep evicting each other
+const char* names[] = {"mamene", "ble", "somehost", "enorme.coiso", "anotherhost"};
+const char* addresses[] = {" 192.168.1.4", " 192.168.1.2", " 192.168.1.1", " 192.168.1.9", " 192.168.1.2"};
+for (int indexflag = 0; indexflag < 2; indexflag++) {
+    DnsResolver resolver("test/simplehosts.txt", 2, 10, 2, false, indexflag, 1, DnsResolver::CACHE_CLOCK);
+    for (int i = 0; i < 3; i++)
+        for (int n = 0; n < 5; n++)
+            EXPECT_EQ (string(addresses[n]), resolver.resolve_to_string(names[n]));
+    EXPECT_THROW(resolver.resolve_to_string("nonexistent"), DnsResolver::ResolveException);
+}
+}
+
+TEST(SucessfulResolution, EvictingCaches) {
+
+// many more names than the cache holds, some longer than fits in an entry
+const char* path = "test/evicthosts.tmp";
+ofstream out(path);
+vector<string> names, expected;
+for (int i = 0; i < 300; i++) {
+    stringstream name, addresses;
+    name << "host" << i << ((i % 50 == 0) ? string(120, 'x') : string(".example"));
+    for (int j = 0; j <= i % 3; j++) {
+        out << "10.0." << j << "." << i % 256 << " " << name.str() << "\n";
+        addresses << " 10.0." << j << "." << i % 256;
+    }
+    names.push_back(name.str());
+    expected.push_back(addresses.str());
+}
+out.close();
+
+for (int policy = 0; policy < DnsResolver::CACHE_POLICIES; policy++) {
+    DnsResolver resolver(path, 16, 10, 5, true, true, 2, static_cast<DnsResolver::CachePolicy>(policy));
+    unsigned int seed = 1;
+    for (int i = 0; i < 5000; i++) {
+        // mostly a few hot names, so that entries get hit as well as evicted
+        int n = (i % 2) ? rand_r(&seed) % 8 : rand_r(&seed) % names.size();
+        ASSERT_EQ (expected[n], resolver.resolve_to_string(names[n]));
+    }
+}
+unlink(path);
+}
+
+TEST(SucessfulResolution, LongNamesAreCached) {
+
+// two names alike up to past the inline part of an entry
+const char* path = "test/longhosts.tmp";
+string common(150, 'x');
+ofstream out(path);
+out << "10.0.0.1 " << common << "a.example\n";
+out << "10.0.0.2 " << common << "b.example\n";
+out.close();
+
+for (int policy = 0; policy < DnsResolver::CACHE_POLICIES; policy++) {
+    DnsResolver resolver(path, 10, 10, 2, true, false, 1, static_cast<DnsResolver::CachePolicy>(policy));
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ (string(" 10.0.0.1"), resolver.resolve_to_string(common + "a.example"));
+        EXPECT_EQ (string(" 10.0.0.2"), resolver.resolve_to_string(common + "b.example"));
+    }
+    // the first two were scans, ARC caches on the second sight
+    EXPECT_LE (4u - (policy == DnsResolver::CACHE_ARC ? 2 : 0), resolver.cache_hits()) << policy;
+}
+unlink(path);
+}
+
+TEST(SucessfulResolution, OverlongNamesAreNotCached) {
+
+// an alias no query could ask for, on every line a scan goes through
+const char* path = "test/overlonghosts.tmp";
+const char* dump = "test/overlongdump.tmp";
+string overlong(300, 'x');
+ofstream out(path);
+for (int i = 1; i <= 3; i++)
+    out << "10.0.0." << i << " host" << i << ".example " << overlong << "\n";
+out.close();
+
+for (int policy = 0; policy < DnsResolver::CACHE_POLICIES; policy++) {
+    DnsResolver resolver(path, 10, 10, 2, true, false, 1, static_cast<DnsResolver::CachePolicy>(policy));
+    for (int i = 1; i <= 3; i++) {
+        stringstream name;
+        name << "host" << i << ".example";
+        resolver.resolve_to_string(name.str());
+    }
+    resolver.save_cache(dump);
+    ifstream in(dump);
+    string line;
+    getline(in, line);
+    while (getline(in, line))
+        EXPECT_EQ (0u, line.find("host")) << policy << ": " << line;
+    // still found in the file all the same
+    EXPECT_EQ (string(" 10.0.0.1"), resolver.resolve_to_string(overlong));
+}
+unlink(dump);
+unlink(path);
+}
+
+TEST(SucessfulResolution, HugeCachesAreRefused) {
+
+EXPECT_THROW(DnsResolver("test/simplehosts.txt", DnsResolver::DEFAULT_CACHE_SIZE[2], 10, 512), DnsResolver::ResolveException);
+DnsResolver resolver("test/simplehosts.txt", 100000, 10, 5);
+EXPECT_EQ (string(" 192.168.1.4"), resolver.resolve_to_string("mamene"));
+}
+
+TEST(CachePolicies, ScanResistance) {
+
+const char* path = "test/scanhosts.tmp";
+ofstream out(path);
+vector<string> names;
+for (int i = 0; i < 200; i++) {
+    stringstream name;
+    name << "host" << i << ".example";
+    out << "10.0.0." << i % 256 << " " << name.str() << "\n";
+    names.push_back(name.str());
+}
+out.close();
+
+// a few hot names survive a burst of one-off names, unlike with plain LRU
+DnsResolver::CachePolicy policies[] = {DnsResolver::CACHE_TINYLFU, DnsResolver::CACHE_ARC};
+for (int p = 0; p < 2; p++) {
+    DnsResolver resolver(path, 16, 10, 5, true, true, 1, policies[p]);
+    for (int i = 0; i < 5; i++)
+        for (int n = 0; n < 8; n++)
+            resolver.resolve_to_string(names[n]);
+    for (int n = 8; n < 200; n++)
+        resolver.resolve_to_string(names[n]);
+    unsigned long before = resolver.cache_hits();
+    for (int n = 0; n < 8; n++)
+        resolver.resolve_to_string(names[n]);
+    EXPECT_EQ (before + 8, resolver.cache_hits()) << DnsResolver::CACHE_POLICY_NAMES[policies[p]];
+}
+unlink(path);
+}
+
+// write a hosts file with the given contents and modification time, replacing
+// any previous one with rename() like most editors do
+static void write_hosts(const char* path, const char* contents, time_t mtime){
+    string temp = string(path) + ".new";
+    ofstream out(temp.c_str());
+    out << contents;
+    out.close();
+    struct utimbuf times;
+    times.actime = times.modtime = mtime;
+    utime(temp.c_str(), &times);
+    rename(temp.c_str(), path);
+}
+
+static bool eventually_resolves(DnsResolver& resolver, const char* name){
+    for (int i = 0; i < 200; i++) {
+        try {
+            resolver.resolve_to_string(name);
+            return true;
+        } catch (DnsResolver::ResolveException& e) {
+            usleep(10000);
+        }
+    }
+    return false;
+}
+
+TEST(Reload, NegativeCacheIsDropped) {
+
+const char* path = "test/negativehosts.tmp";
+// the comment gets "missing" past the filter, the scan won't find it
+write_hosts(path, "10.0.0.1 present\n# missing\n", 1000);
+
+DnsResolver resolver(path, 10, 10, 2);
+addr_set_t result;
+EXPECT_FALSE(resolver.resolve("missing", result));
+EXPECT_FALSE(resolver.resolve("missing", result));
+EXPECT_EQ (1u, resolver.negative_hits());
+EXPECT_TRUE(result.empty());
+
+// this one never gets past the filter
+EXPECT_FALSE(resolver.resolve("nowhere", result));
+EXPECT_EQ (1u, resolver.filtered());
+EXPECT_EQ (1u, resolver.negative_hits());
+
+write_hosts(path, "10.0.0.1 present\n10.0.0.2 missing\n", 2000);
+EXPECT_TRUE(eventually_resolves(resolver, "missing"));
+EXPECT_EQ (string(" 10.0.0.2"), resolver.resolve_to_string("missing"));
+unlink(path);
+}
+
+TEST(Reload, ChangedFileIsPickedUp) {
+
+for (int indexflag = 0; indexflag < 2; indexflag++) {
+    const char* path = "test/reloadhosts.tmp";
+    write_hosts(path, "10.0.0.1 before\n", 1000);
+
+    DnsResolver resolver(path, 10, 10, 2, false, indexflag);
+    EXPECT_EQ (string(" 10.0.0.1"), resolver.resolve_to_string("before"));
+
+    write_hosts(path, "10.0.0.2 after\n", 2000);
+    EXPECT_TRUE(eventually_resolves(resolver, "after"));
+    EXPECT_THROW(resolver.resolve_to_string("before"), DnsResolver::ResolveException);
+    unlink(path);
+}
+}
+
+TEST(Reload, CacheSurvivesSmallEdits) {
+
+// scan mode, index mode, and index mode with the CLOCK cache
+for (int mode = 0; mode < 3; mode++) {
+    const char* path = "test/edithosts.tmp";
+    write_hosts(path, "10.0.0.1 kept\n10.0.0.2 moved\n10.0.0.3 dropped\n", 1000);
+
+    DnsResolver resolver(path, 10, 10, 2, false, mode > 0, 1,
+                         (mode == 2) ? DnsResolver::CACHE_CLOCK : DnsResolver::CACHE_LRU);
+    EXPECT_EQ (string(" 10.0.0.1"), resolver.resolve_to_string("kept"));
+    EXPECT_EQ (string(" 10.0.0.2"), resolver.resolve_to_string("moved"));
+    EXPECT_EQ (string(" 10.0.0.3"), resolver.resolve_to_string("dropped"));
+
+    write_hosts(path, "10.0.0.1 kept\n10.0.0.9 moved\n10.0.0.4 added\n", 2000);
+    EXPECT_TRUE(eventually_resolves(resolver, "added"));
+    unsigned long hits = resolver.cache_hits();
+    EXPECT_EQ (string(" 10.0.0.1"), resolver.resolve_to_string("kept"));
+    EXPECT_EQ (hits + 1, resolver.cache_hits());
+    EXPECT_EQ (string(" 10.0.0.9"), resolver.resolve_to_string("moved"));
+    EXPECT_THROW(resolver.resolve_to_string("dropped"), DnsResolver::ResolveException);
+    unlink(path);
+}
+}
+
+TEST(Reload, FileTruncatedInPlace) {
+
+// truncate(), as "cat new > hosts" does first, under a resolver that scans
+// on every miss: without watching, the copy it read still answers, and
+// watching, it answers or doesn't, but doesn't crash
+for (int nostat = 1; nostat >= 0; nostat--) {
+    const char* path = "test/truncatehosts.tmp";
+    write_hosts(path, "10.0.0.1 first\n10.0.0.2 second\n10.0.0.3 third\n", 1000);
+
+    DnsResolver resolver(path, 1, 10, 2, nostat);
+    EXPECT_EQ (string(" 10.0.0.1"), resolver.resolve_to_string("first"));
+    ASSERT_EQ (0, truncate(path, 0));
+    const char* names[] = {"second", "third", "first"};
+    for (int i = 0; i < 3; i++) {
+        try {
+            string found = resolver.resolve_to_string(names[i]);
+            EXPECT_EQ (string(" 10.0.0.") + (char) ('1' + (i + 1) % 3), found);
+        } catch (DnsResolver::ResolveException& e) {
+            EXPECT_FALSE (nostat);
+        }
+    }
+    unlink(path);
+}
+}
+
+TEST(CacheDump, WarmsUpAnotherResolver) {
+
+const char* path = "test/cachedump.tmp";
+const char* names[] = {"ble", "mamene", "somehost"};
+// index mode, scans would cache the other names on their lines too
+for (int policy = 0; policy < DnsResolver::CACHE_POLICIES; policy++) {
+    DnsResolver::CachePolicy p = static_cast<DnsResolver::CachePolicy>(policy);
+    {
+        DnsResolver resolver("test/simplehosts.txt", 10, 10, 2, true, true, 1, p);
+        for (int n = 0; n < 3; n++)
+            resolver.resolve_to_string(names[n]);
+        EXPECT_EQ (3u, resolver.save_cache(path));
+    }
+    DnsResolver resolver("test/simplehosts.txt", 10, 10, 2, true, true, 1, p);
+    EXPECT_EQ (3u, resolver.warm_cache(path));
+    // warming up counts for nothing
+    EXPECT_EQ (0u, resolver.cache_hits());
+    EXPECT_EQ (0u, resolver.cache_misses());
+    for (int n = 0; n < 3; n++)
+        resolver.resolve_to_string(names[n]);
+    EXPECT_EQ (3u, resolver.cache_hits());
+}
+
+// a smaller cache keeps the most recently used names
+DnsResolver resolver("test/simplehosts.txt", 2, 10, 2, true, true, 1);
+EXPECT_EQ (2u, resolver.warm_cache(path));
+resolver.resolve_to_string("somehost");
+resolver.resolve_to_string("mamene");
+EXPECT_EQ (2u, resolver.cache_hits());
+unlink(path);
+}
+
+TEST(CacheDump, BadDumpsAreIgnored) {
+
+const char* path = "test/cachedump.tmp";
+DnsResolver resolver("test/simplehosts.txt", 10, 10, 2, true, false, 1);
+unlink(path);
+EXPECT_EQ (0u, resolver.warm_cache(path));
+
+ofstream out(path);
+out << "somehost\nble\n";
+out.close();
+EXPECT_EQ (0u, resolver.warm_cache(path));
+
+// stale names, garbage and a truncated last line
+out.open(path);
+out << "# minns cache dump 1\nsomehost\nno.such.host\nbad name\n\n\x01\x02\nbl";
+out.close();
+EXPECT_EQ (1u, resolver.warm_cache(path));
+resolver.resolve_to_string("somehost");
+EXPECT_EQ (1u, resolver.cache_hits());
+unlink(path);
+}
+
+TEST(SucessfulResolution, AnswerRecords) {
+
+// bla has two addresses, so a buffer of one record is too small. Index
+// mode, scans stop at the first line with the name
+const unsigned char prefix[12] = {0xC0, 0x0C, 0, 1, 0, 1, 0, 0, 0, 0, 0, 4};
+for (int policy = 0; policy < DnsResolver::CACHE_POLICIES; policy++) {
+    DnsResolver resolver("test/simplehosts.txt", 10, 10, 2, true, true, 1, static_cast<DnsResolver::CachePolicy>(policy));
+    string name("bla");
+    uint64_t hash = hash64_helper(name.data(), name.size());
+    // a miss, then hits, then a buffer too small
+    for (int round = 0; round < 3; round++) {
+        char answers[2 * DnsResolver::ANSWER_RECORD_SIZE];
+        size_t count = 0;
+        size_t buflen = (round < 2) ? sizeof(answers) : DnsResolver::ANSWER_RECORD_SIZE;
+        ASSERT_TRUE(resolver.resolve(name, hash, answers, buflen, count));
+        EXPECT_EQ (2u, count);
+        addr_set_t found;
+        for (size_t i = 0; i < buflen / DnsResolver::ANSWER_RECORD_SIZE; i++) {
+            EXPECT_EQ (0, memcmp(prefix, &answers[i * DnsResolver::ANSWER_RECORD_SIZE], sizeof(prefix)));
+            struct in_addr ip;
+            memcpy(&ip, &answers[i * DnsResolver::ANSWER_RECORD_SIZE + sizeof(prefix)], sizeof(ip));
+            found.insert(ip);
+        }
+        EXPECT_EQ (buflen / DnsResolver::ANSWER_RECORD_SIZE, found.size());
+    }
+    EXPECT_EQ (2u, resolver.cache_hits());
+    size_t count = 0;
+    char answers[DnsResolver::ANSWER_RECORD_SIZE];
+    EXPECT_FALSE(resolver.resolve("nonexistent", hash64_helper("nonexistent", 11), answers, sizeof(answers), count));
+}
+}
@@ -0,0 +1,85 @@
+// Time taken to lowercase and hash a query name, per name length: a byte at
+// a time with FNV-1a, as names used to be hashed, a byte at a time into
+// hash64_helper(), and lowercase_helper(), which lowercases 16 bytes at a
+// time where SSE2 is available and hashes them on the way.
+//
+//    usage: hashBench [ROUNDS]
+
+// libc includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+// stdl includes
+#include <string>
+#include <vector>
+
+// project includes
+#include "helper.h"
+
+using namespace std;
+
+static const unsigned int NAMES = 1024;
+static const size_t LENGTHS[] = {8, 16, 32, 64, 128};
+
+static double now(){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static uint64_t fnv_lowercase(char* dst, const char* src, size_t len){
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        dst[i] = (src[i] >= 'A' && src[i] <= 'Z') ? (src[i] | 0x20) : src[i];
+        h ^= (unsigned char) dst[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static uint64_t scalar_lowercase(char* dst, const char* src, size_t len){
+    for (size_t i = 0; i < len; i++)
+        dst[i] = (src[i] >= 'A' && src[i] <= 'Z') ? (src[i] | 0x20) : src[i];
+    return hash64_helper(dst, len);
+}
+
+typedef uint64_t (*kernel_t)(char*, const char*, size_t);
+
+static double measure(kernel_t kernel, const vector<string>& names, unsigned int rounds, uint64_t& sink){
+    char dst[256];
+    double start = now();
+    for (unsigned int r = 0; r < rounds; r++)
+        for (size_t i = 0; i < names.size(); i++)
+            sink += kernel(dst, names[i].data(), names[i].size());
+    return (now() - start) * 1e9 / ((double) rounds * names.size());
+}
+
+int main(int argc, char* argv[]){
+    unsigned int rounds = (argc > 1) ? atoi(argv[1]) : 2000;
+    uint64_t sink = 0;
+
+    printf("%6s %12s %12s %12s\n", "length", "fnv", "scalar", "lowercase");
+    for (size_t l = 0; l < sizeof(LENGTHS) / sizeof(LENGTHS[0]); l++) {
+        // mixed case labels of up to 15 characters
+        vector<string> names;
+        unsigned int seed = 1;
+        for (unsigned int n = 0; n < NAMES; n++) {
+            string name;
+            for (size_t i = 0; i < LENGTHS[l]; i++) {
+                if (i % 16 == 15)
+                    name += '.';
+                else
+                    name += (rand_r(&seed) % 2 ? 'A' : 'a') + rand_r(&seed) % 26;
+            }
+            names.push_back(name);
+        }
+        printf("%6u", (unsigned int) LENGTHS[l]);
+        printf(" %9.1f ns", measure(fnv_lowercase, names, rounds, sink));
+        printf(" %9.1f ns", measure(scalar_lowercase, names, rounds, sink));
+        printf(" %9.1f ns\n", measure(lowercase_helper, names, rounds, sink));
+    }
+    // so that no kernel gets optimized away
+    return sink == 42;
+}
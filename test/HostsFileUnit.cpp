@@ -0,0 +1,67 @@
+// libstdc++ includes
+#include <fstream>
+#include <string>
+
+// libc includes
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+// project includes
+#include "HostsFile.h"
+#include "gtest/gtest.h"
+
+// usings
+using namespace std;
+
+static string tokenize(const char* contents, unsigned int maxaliases){
+    const char* path = "test/tokenizer.tmp";
+    ofstream out(path);
+    out << contents;
+    out.close();
+    HostsFile file(path);
+    unlink(path);
+
+    string joined;
+    HostsFile::Tokenizer tokenizer(file.begin(), file.end(), maxaliases);
+    HostsFile::Record record;
+    while (tokenizer.next(record)) {
+        joined += inet_ntoa(record.ip);
+        for (size_t i = 0; i < record.names.size(); i++)
+            joined += " " + string(record.names[i].ptr, record.names[i].len);
+        joined += "|";
+    }
+    return joined;
+}
+
+TEST(HostsFile, AddressesLikeInetPton) {
+
+const char* inputs[] = {
+    "192.168.1.1", "0.0.0.0", "255.255.255.255", "10.0.0.1",
+    "256.0.0.1", "1.2.3.256", "01.2.3.4", "1.2.3.00", "1.2.3", "1.2.3.4.5",
+    "1.2.3.4x", "", ".1.2.3", "1..2.3", "1.2.3.", "a.b.c.d", "1.2.3.-4",
+    "9999999999.1.1.1", "::1", "1.2.3.4 "
+};
+for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+    struct in_addr expected, parsed;
+    int ok = inet_pton(AF_INET, inputs[i], &expected);
+    EXPECT_EQ (ok == 1, HostsFile::parse_address(inputs[i], inputs[i] + strlen(inputs[i]), parsed)) << inputs[i];
+    if (ok == 1)
+        EXPECT_EQ (expected.s_addr, parsed.s_addr) << inputs[i];
+}
+}
+
+TEST(HostsFile, Tokenizer) {
+
+EXPECT_EQ (string("10.0.0.1 a b|10.0.0.2 c|"), tokenize("10.0.0.1 a b\n10.0.0.2 c\n", 5));
+// comments, blank lines, bad addresses and lines without names
+EXPECT_EQ (string("10.0.0.1 a|10.0.0.3 c|"),
+           tokenize("# 10.0.0.9 x\n\n   \n10.0.0.1 a # b\nbad b\n10.0.0.2\n  \t10.0.0.3\tc", 5));
+// all kinds of blanks, and names longer than a vector
+EXPECT_EQ (string("10.0.0.1 a.rather.long.name.in.the.example.domain b|10.0.0.2 c#d|"),
+           tokenize("10.0.0.1\v a.rather.long.name.in.the.example.domain \f\t                  b\r\n10.0.0.2 c#d\r\n", 5));
+// maxaliases truncation
+EXPECT_EQ (string("10.0.0.1 a b|10.0.0.2 d|"), tokenize("10.0.0.1 a b c\n10.0.0.2 d\n", 2));
+EXPECT_EQ (string(""), tokenize("", 5));
+}
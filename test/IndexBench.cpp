@@ -0,0 +1,110 @@
+// Memory per name and lookup latency of the ways to find a name's addresses
+// once the cache misses: a std::map from names to address sets, as the
+// resolver's cache used to be, the hash index (-x) and the perfect hash
+// index (-k). The indexes are measured through DnsResolver::resolve() with a
+// one name cache, so their numbers include the Bloom filter and a cache
+// miss; their memory includes the filter too, but not the names, which stay
+// in the hosts file's mapping.
+//
+//    usage: indexBench [NAMES]
+
+// libc includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/time.h>
+
+// stdl includes
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <map>
+
+// project includes
+#include "DnsResolver.h"
+
+using namespace std;
+
+static const unsigned int QUERIES = 1000000;
+
+static double now(){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static size_t heap_used(){
+    struct mallinfo info = mallinfo();
+    return (size_t) (unsigned int) info.uordblks + (size_t) (unsigned int) info.hblkhd;
+}
+
+static void report(const char* what, size_t bytes, double elapsed, size_t names){
+    printf("%-12s %8.1f bytes/name %8.1f ns/lookup\n", what,
+           (double) bytes / names, elapsed * 1e9 / QUERIES);
+}
+
+int main(int argc, char* argv[]){
+    unsigned int count = (argc > 1) ? atoi(argv[1]) : 200000;
+
+    char path[] = "/tmp/indexBench.XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    vector<string> names;
+    vector<struct in_addr> ips;
+    ofstream out(path);
+    for (unsigned int i = 0; i < count; i++) {
+        stringstream ss;
+        ss << "host" << i << ".bench.example";
+        names.push_back(ss.str());
+        struct in_addr ip;
+        ip.s_addr = htonl(0x0A000000 + i);
+        ips.push_back(ip);
+        out << inet_ntoa(ip) << " " << names.back() << "\n";
+    }
+    out.close();
+
+    // the same random names for everybody
+    vector<unsigned int> order(QUERIES);
+    unsigned int seed = 1;
+    for (unsigned int i = 0; i < QUERIES; i++)
+        order[i] = rand_r(&seed) % count;
+
+    // keep the resolver's tracing out of the measurements
+    clog.setstate(ios::badbit);
+
+    cout << count << " names, " << QUERIES << " random lookups" << endl;
+    {
+        size_t before = heap_used();
+        map<string, addr_set_t>* names_map = new map<string, addr_set_t>;
+        for (unsigned int i = 0; i < count; i++)
+            (*names_map)[names[i]].insert(ips[i]);
+        size_t bytes = heap_used() - before;
+        addr_set_t result;
+        double start = now();
+        for (unsigned int i = 0; i < QUERIES; i++) {
+            result.clear();
+            map<string, addr_set_t>::const_iterator iter = names_map->find(names[order[i]]);
+            if (iter != names_map->end())
+                result.insert(iter->second.begin(), iter->second.end());
+        }
+        report("std::map", bytes, now() - start, count);
+        delete names_map;
+    }
+    for (int perfect = 0; perfect < 2; perfect++) {
+        size_t before = heap_used();
+        DnsResolver resolver(path, 1, 5, 5, true, true, 1, DnsResolver::CACHE_LRU, 0, perfect);
+        size_t bytes = heap_used() - before;
+        addr_set_t result;
+        double start = now();
+        for (unsigned int i = 0; i < QUERIES; i++) {
+            result.clear();
+            resolver.resolve(names[order[i]], result);
+        }
+        report(perfect ? "perfect" : "hash", bytes, now() - start, count);
+    }
+
+    unlink(path);
+    return 0;
+}
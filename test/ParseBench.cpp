@@ -0,0 +1,73 @@
+// Time and heap allocations taken to parse a query into a DnsQuery, which
+// points into the receive buffer, and to print it, as the workers do when
+// tracing. Allocations are counted by replacing the global operator new.
+//
+//    usage: parseBench [ROUNDS]
+
+// libc includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+// stdl includes
+#include <new>
+#include <sstream>
+
+// project includes
+#include "DnsMessage.h"
+
+using namespace std;
+
+static unsigned long allocations = 0;
+
+void* operator new(size_t size) throw (std::bad_alloc){
+    allocations++;
+    void* p = malloc(size ? size : 1);
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) throw (){ free(p); }
+
+static double now(){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// www.Example.com, type A, class IN
+static const char QUERY[] =
+    "\x12\x34\x01\x00\x00\x01\x00\x00\x00\x00\x00\x00"
+    "\x03www\x07" "Example\x03" "com\x00" "\x00\x01\x00\x01";
+
+static void report(const char* what, double elapsed, unsigned long allocs, unsigned int rounds){
+    printf("%-12s %8.1f ns/query %8.2f allocations/query\n", what,
+           elapsed * 1e9 / rounds, (double) allocs / rounds);
+}
+
+int main(int argc, char* argv[]){
+    unsigned int rounds = (argc > 1) ? atoi(argv[1]) : 1000000;
+    unsigned long sink = 0;
+
+    unsigned long before = allocations;
+    double start = now();
+    for (unsigned int r = 0; r < rounds; r++) {
+        DnsQuery view(QUERY, sizeof(QUERY) - 1);
+        sink += view.questions[0].hash;
+    }
+    report("DnsQuery", now() - start, allocations - before, rounds);
+
+    before = allocations;
+    start = now();
+    for (unsigned int r = 0; r < rounds; r++) {
+        DnsQuery view(QUERY, sizeof(QUERY) - 1);
+        ostringstream os;
+        os << view;
+        sink += os.str().size();
+    }
+    report("printed", now() - start, allocations - before, rounds);
+
+    // so that nothing gets optimized away
+    return sink == 42;
+}
@@ -0,0 +1,139 @@
+// Fuzz target for DnsQuery: whatever the bytes, parsing them either throws a
+// DnsException or gives a query that can be answered and printed, without
+// reading or writing past any buffer. `make fuzz` builds it with clang's
+// libFuzzer and AddressSanitizer, run it from the top directory, where
+// test/simplehosts.txt is:
+//
+//    usage: test/parseFuzz [CORPUS_DIR]
+//
+// Built with -DPARSE_FUZZ_MAIN, as `make parseFuzzMain` does, it needs no
+// libFuzzer: it replays the files given to it, or mutates a few seed
+// queries at random for ROUNDS rounds.
+//
+//    usage: test/parseFuzzMain [FILE...]
+//           test/parseFuzzMain -r ROUNDS
+
+// libc includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// stdl includes
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+// project includes
+#include "DnsMessage.h"
+#include "TcpSocket.h"
+
+using namespace std;
+
+static DnsResolver& resolver(){
+    static DnsResolver* r = NULL;
+    if (r == NULL) {
+        // the resolver and the parser warn about every other query
+        clog.setstate(ios::badbit);
+        r = new DnsResolver("test/simplehosts.txt", 10, 10, 10, true, true, 1);
+    }
+    return *r;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size){
+    static char buff[TcpSocket::DEFAULT_MAX_MSG];
+    static char response[TcpSocket::DEFAULT_MAX_MSG];
+    if (size > sizeof(buff))
+        return 0;
+    memcpy(buff, data, size);
+
+    try {
+        DnsQuery query(buff, size);
+        if (query.end > size || query.qdcount > DnsQuery::MAX_QUESTIONS)
+            abort();
+        for (unsigned int i = 0; i < query.qdcount; i++)
+            // labels may well have zeros in them, the key ends after them
+            if (query.questions[i].keylen > DnsQuery::MAX_NAME || query.questions[i].key[query.questions[i].keylen] != '\0')
+                abort();
+
+        // as a UDP worker would answer it, and then as a TCP one, in place
+        size_t limit = query.udp_size(DnsQuery::EDNS_PAYLOAD);
+        try {
+            if (query.respond(resolver(), response, limit) > limit)
+                abort();
+        } catch (DnsMessage::SerializeException& e) {}
+        try {
+            if (query.respond(resolver(), buff, sizeof(buff)) > sizeof(buff))
+                abort();
+        } catch (DnsMessage::SerializeException& e) {}
+
+        ostringstream os;
+        os << query;
+    } catch (DnsMessage::DnsException& e) {
+        // as the workers answer what doesn't parse
+        DnsErrorResponse error(e);
+        if (error.serialize(response, sizeof(response)) > sizeof(response))
+            abort();
+    }
+    return 0;
+}
+
+#ifdef PARSE_FUZZ_MAIN
+
+// www.Example.com A, mail.example.com A pointing at it, with an OPT record
+static const char COMPRESSED[] =
+    "\x12\x34\x01\x00\x00\x02\x00\x00\x00\x00\x00\x01"
+    "\x03www\x07" "Example\x03" "com\x00\x00\x01\x00\x01"
+    "\x04mail\xC0\x10\x00\x01\x00\x01"
+    "\x00\x00\x29\x10\x00\x00\x00\x00\x00\x00\x00";
+
+// 4.1.168.192.in-addr.arpa PTR and bla A
+static const char REVERSE[] =
+    "\x12\x34\x01\x00\x00\x02\x00\x00\x00\x00\x00\x00"
+    "\x01" "4\x01" "1\x03" "168\x03" "192\x07" "in-addr\x04" "arpa\x00\x00\x0C\x00\x01"
+    "\x03" "bla\x00\x00\x01\x00\x01";
+
+static const struct { const char* data; size_t size; } SEEDS[] = {
+    {COMPRESSED, sizeof(COMPRESSED) - 1},
+    {REVERSE, sizeof(REVERSE) - 1}
+};
+
+// flip, overwrite, drop or repeat a few bytes of seed
+static string mutate(const string& seed){
+    string s(seed);
+    for (int n = 1 + rand() % 4; n > 0 && !s.empty(); n--) {
+        size_t pos = rand() % s.size();
+        switch (rand() % 4) {
+        case 0: s[pos] ^= 1 << (rand() % 8); break;
+        case 1: s[pos] = rand(); break;
+        case 2: s.erase(pos, 1 + rand() % 4); break;
+        case 3: s.insert(pos, s.substr(pos, 1 + rand() % 8)); break;
+        }
+    }
+    return s;
+}
+
+int main(int argc, char* argv[]){
+    if (argc > 2 && strcmp(argv[1], "-r") == 0) {
+        unsigned long rounds = strtoul(argv[2], NULL, 10);
+        srand(rounds);
+        for (unsigned long i = 0; i < rounds; i++) {
+            const unsigned int seed = i % (sizeof(SEEDS) / sizeof(SEEDS[0]));
+            string s = mutate(string(SEEDS[seed].data, SEEDS[seed].size));
+            LLVMFuzzerTestOneInput((const uint8_t*) s.data(), s.size());
+        }
+        printf("%lu mutated queries\n", rounds);
+        return 0;
+    }
+    for (int i = 1; i < argc; i++) {
+        ifstream in(argv[i], ios::binary);
+        string s((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        LLVMFuzzerTestOneInput((const uint8_t*) s.data(), s.size());
+    }
+    printf("%d queries replayed\n", argc - 1);
+    return 0;
+}
+
+#endif // PARSE_FUZZ_MAIN
@@ -0,0 +1,45 @@
+// libstdc++ includes
+#include <vector>
+
+// libc includes
+#include <stdio.h>
+
+// project includes
+#include "PerfectHash.h"
+#include "helper.h"
+#include "gtest/gtest.h"
+
+// usings
+using namespace std;
+
+TEST(PerfectHash, Minimal) {
+
+// every key gets its own number below the number of keys
+unsigned int sizes[] = {1, 2, 3, 17, 1000, 100000};
+char name[32];
+for (int s = 0; s < 6; s++) {
+    vector<uint64_t> keys;
+    for (unsigned int i = 0; i < sizes[s]; i++) {
+        int len = snprintf(name, sizeof(name), "host%u.example", i);
+        keys.push_back(hash64_helper(name, len));
+    }
+    PerfectHash hash(keys);
+    vector<bool> seen(keys.size(), false);
+    for (size_t i = 0; i < keys.size(); i++) {
+        uint32_t n = hash.lookup(keys[i]);
+        ASSERT_LT (n, keys.size());
+        EXPECT_FALSE(seen[n]);
+        seen[n] = true;
+    }
+    EXPECT_LT (hash.size() * 8, keys.size() * 8 + 64);
+}
+}
+
+TEST(PerfectHash, DuplicateKeys) {
+
+vector<uint64_t> keys;
+keys.push_back(1);
+keys.push_back(2);
+keys.push_back(1);
+EXPECT_THROW(PerfectHash hash(keys), PerfectHash::BuildException);
+}